@@ -11,8 +11,13 @@ uniform sampler2D texture_normal1;
 uniform sampler2D texture_roughness1;
 uniform sampler2D texture_ao1;
 
-uniform vec3 cameraPosition;
-uniform vec3 lightDirection;
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
 
 vec4 lerp(vec4 a, vec4 b, float t)
 {
@@ -8,8 +8,14 @@ out vec3 Normals;
 out vec4 FragPos;
 
 uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
 
 void main()
 {
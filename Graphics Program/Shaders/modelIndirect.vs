@@ -0,0 +1,37 @@
+#version 430 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+// index of the draw in the batch, fed through an instanced attribute offset by the draw's base instance.
+layout(location = 7) in uint aDrawID;
+
+out vec2 TexCoords;
+out vec3 Normals;
+out vec4 FragPos;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
+
+// world matrix of every draw in the batch.
+layout(std430, binding = 1) readonly buffer DrawData
+{
+    mat4 worlds[];
+};
+
+void main()
+{
+    mat4 world = worlds[aDrawID];
+
+    TexCoords = aTexCoords;
+    FragPos = world * vec4(aPos, 1.0);
+    gl_Position = projection * view * FragPos;
+
+    // not the most efficient, but it works
+    Normals = normalize( mat3(inverse(transpose(world)))* aNormal );
+}
\ No newline at end of file
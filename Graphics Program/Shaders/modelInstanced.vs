@@ -0,0 +1,30 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+// world and normal matrix of the instance, one column per location.
+layout(location = 8) in mat4 aWorld;
+layout(location = 12) in mat3 aNormalMatrix;
+
+out vec2 TexCoords;
+out vec3 Normals;
+out vec4 FragPos;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
+
+void main()
+{
+    TexCoords = aTexCoords;
+    FragPos = aWorld * vec4(aPos, 1.0);
+    gl_Position = projection * view * FragPos;
+
+    // the inverse transpose is worked out once per instance, on the CPU
+    Normals = normalize( aNormalMatrix * aNormal );
+}
\ No newline at end of file
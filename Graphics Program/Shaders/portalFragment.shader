@@ -7,7 +7,10 @@ in vec2 ScreenCoords;
 uniform sampler2D renderTexture;
 uniform sampler2D testTexture;
 
+//	Scale and offset from the screen to where the view is sampled, for views that were rendered at another spot.
+uniform vec4 sampleTransform;
+
 void main()
 {
-	FragColor = texture(renderTexture, ScreenCoords);
+	FragColor = texture(renderTexture, ScreenCoords * sampleTransform.xy + sampleTransform.zw);
 }
\ No newline at end of file
@@ -9,8 +9,14 @@ out vec4 FragPos;
 out vec2 ScreenCoords;
 
 uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
 
 void main()
 {
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "projection.h"
+
+//	Amount of frames a GPU timer query is given before its result is read back.
+#define BENCHMARK_QUERY_LATENCY 4
+
+/// <summary>
+/// Deterministic frame benchmark. Moves a projection along a scripted path and records
+/// per-pass CPU submission time and GPU time (through timer queries), then writes a JSON report.
+/// </summary>
+class Benchmark
+{
+public:
+	int frameCount		= 0;
+	int warmupFrames	= 0;
+	int frame			= 0;
+
+	/// <summary>
+	/// Creates a benchmark of _frameCount recorded frames, preceded by _warmupFrames frames that are rendered but not recorded.
+	/// </summary>
+	Benchmark(int _frameCount, int _warmupFrames, const std::vector<std::string>& _passNames)
+	{
+		frameCount		= _frameCount;
+		warmupFrames	= _warmupFrames;
+		passNames		= _passNames;
+
+		cpuSamples.resize(passNames.size());
+		gpuSamples.resize(passNames.size());
+
+		//	Creating a ring of timer queries, so results can be read back without stalling.
+		queries.resize(BENCHMARK_QUERY_LATENCY * passNames.size());
+		queryFrame.resize(queries.size(), -1);
+		glGenQueries((GLsizei)queries.size(), queries.data());
+	}
+
+	~Benchmark()
+	{
+		glDeleteQueries((GLsizei)queries.size(), queries.data());
+	}
+
+	/// <summary>
+	/// Returns true once every scripted frame has been rendered.
+	/// </summary>
+	bool finished() const
+	{
+		return frame >= warmupFrames + frameCount;
+	}
+
+	/// <summary>
+	/// Places the projection on the scripted camera path for the current frame.
+	/// </summary>
+	void moveAlongPath(Projection* _projection) const
+	{
+		//	Slow orbit around the middle of the terrain while looking at it, bobbing up and down so the portals pass in and out of view.
+		float t			= (frame - warmupFrames) / (float)std::max(frameCount, 1);
+		float angle		= t * glm::radians(360.0f);
+		glm::vec3 center	= glm::vec3(1280, 0, 1280);
+
+		_projection->position	= center + glm::vec3(glm::sin(angle) * 1400.0f, 450.0f + glm::sin(angle * 3.0f) * 150.0f, glm::cos(angle) * 1400.0f);
+		_projection->yaw		= glm::degrees(angle) + 180.0f;
+		_projection->pitch		= 15.0f;
+
+		if (_projection->yaw > 180.0f) _projection->yaw -= 360.0f;
+
+		_projection->recalculate();
+	}
+
+	void beginFrame()
+	{
+		//	Collect results from the queries we are about to reuse.
+		collectQueries(frame % BENCHMARK_QUERY_LATENCY);
+
+		frameStart = clock::now();
+	}
+
+	void endFrame()
+	{
+		if (recording()) frameSamples.push_back(elapsed(frameStart));
+		frame++;
+	}
+
+	void beginPass(int _pass)
+	{
+		GLuint query = queries[slot(frame % BENCHMARK_QUERY_LATENCY, _pass)];
+		glBeginQuery(GL_TIME_ELAPSED, query);
+
+		passStart = clock::now();
+	}
+
+	void endPass(int _pass)
+	{
+		if (recording()) cpuSamples[_pass].push_back(elapsed(passStart));
+
+		glEndQuery(GL_TIME_ELAPSED);
+		queryFrame[slot(frame % BENCHMARK_QUERY_LATENCY, _pass)] = frame;
+	}
+
+	/// <summary>
+	/// Records a single named value in the report, e.g. startup time or a counter.
+	/// </summary>
+	void setMetric(const std::string& _name, double _value)
+	{
+		metrics[_name] = _value;
+	}
+
+	/// <summary>
+	/// Times a batch of calls to a query, and records how many run per second as a metric.
+	/// </summary>
+	/// <param name="_query">Callable taking the call index and returning a number, which is kept so the call can't be optimized away.</param>
+	template <typename Query>
+	void measureThroughput(const std::string& _name, int _count, const Query& _query)
+	{
+		double sum = 0;
+
+		clock::time_point start = clock::now();
+		for (int i = 0; i < _count; i++) sum += _query(i);
+
+		setMetric(_name, _count / (elapsed(start) / 1000.0));
+		sink = sum;
+	}
+
+	/// <summary>
+	/// Writes the report as JSON.
+	/// </summary>
+	/// <param name="_path">The file to write to.</param>
+	/// <returns>Whether the file could be written.</returns>
+	bool write(const char* _path)
+	{
+		//	Wait for the GPU and read back every query still in flight.
+		glFinish();
+		for (int i = 0; i < BENCHMARK_QUERY_LATENCY; i++) collectQueries(i);
+
+		std::ofstream file(_path);
+		if (!file.is_open())
+		{
+			std::cout << "ERROR: Could not write benchmark report to " << _path << "." << std::endl;
+			return false;
+		}
+
+		file << "{\n";
+		file << "\t\"frames\": " << frame - warmupFrames << ",\n";
+		file << "\t\"warmupFrames\": " << warmupFrames << ",\n";
+		file << "\t\"renderer\": \"" << glGetString(GL_RENDERER) << "\",\n";
+
+		//	Single values.
+		file << "\t\"metrics\": {";
+		for (auto it = metrics.begin(); it != metrics.end(); it++)
+		{
+			file << (it == metrics.begin() ? "\n" : ",\n") << "\t\t\"" << it->first << "\": " << it->second;
+		}
+		file << "\n\t},\n";
+
+		//	Per pass timings.
+		file << "\t\"passes\": {\n";
+		for (size_t i = 0; i < passNames.size(); i++)
+		{
+			file << "\t\t\"" << passNames[i] << "\": {\n";
+			file << "\t\t\t\"runs\": " << cpuSamples[i].size() << ",\n";
+			file << "\t\t\t\"cpuMs\": ";	writeStats(file, cpuSamples[i]);	file << ",\n";
+			file << "\t\t\t\"gpuMs\": ";	writeStats(file, gpuSamples[i]);	file << "\n";
+			file << "\t\t}" << (i + 1 < passNames.size() ? "," : "") << "\n";
+		}
+		file << "\t},\n";
+
+		//	Whole frame timings.
+		file << "\t\"frameCpuMs\": ";
+		writeStats(file, frameSamples);
+		file << "\n}\n";
+
+		return true;
+	}
+
+private:
+	typedef std::chrono::high_resolution_clock clock;
+
+	std::vector<std::string> passNames;
+	std::map<std::string, double> metrics;
+
+	//	Timings in milliseconds.
+	std::vector<std::vector<double>> cpuSamples;
+	std::vector<std::vector<double>> gpuSamples;
+	std::vector<double> frameSamples;
+
+	//	Timer queries, BENCHMARK_QUERY_LATENCY frames worth, and the frame each was last issued in. (-1 if not in flight)
+	std::vector<GLuint> queries;
+	std::vector<int> queryFrame;
+
+	clock::time_point frameStart, passStart;
+
+	//	Receives the results of measured queries.
+	volatile double sink = 0;
+
+	bool recording() const
+	{
+		return frame >= warmupFrames;
+	}
+
+	size_t slot(int _frameSlot, int _pass) const
+	{
+		return _frameSlot * passNames.size() + _pass;
+	}
+
+	void collectQueries(int _frameSlot)
+	{
+		for (size_t i = 0; i < passNames.size(); i++)
+		{
+			size_t index = slot(_frameSlot, (int)i);
+			if (queryFrame[index] < 0) continue;
+
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(queries[index], GL_QUERY_RESULT, &nanoseconds);
+
+			if (queryFrame[index] >= warmupFrames) gpuSamples[i].push_back(nanoseconds / 1000000.0);
+			queryFrame[index] = -1;
+		}
+	}
+
+	static double elapsed(clock::time_point _start)
+	{
+		return std::chrono::duration<double, std::milli>(clock::now() - _start).count();
+	}
+
+	/// <summary>
+	/// Writes mean, median, 95th percentile, min and max of a set of samples as a JSON object.
+	/// </summary>
+	static void writeStats(std::ofstream& _file, std::vector<double> _samples)
+	{
+		if (_samples.empty())
+		{
+			_file << "null";
+			return;
+		}
+
+		std::sort(_samples.begin(), _samples.end());
+
+		double sum = 0;
+		for (double sample : _samples) sum += sample;
+
+		_file << "{ \"mean\": "	<< sum / _samples.size()
+			<< ", \"median\": "	<< _samples[_samples.size() / 2]
+			<< ", \"p95\": "	<< _samples[std::min(_samples.size() - 1, (size_t)(_samples.size() * 0.95))]
+			<< ", \"min\": "	<< _samples.front()
+			<< ", \"max\": "	<< _samples.back() << " }";
+	}
+};
@@ -0,0 +1,293 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "../mipmap.h"
+#include "../dds.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+//	Material maps that get cooked. Normal maps aren't, block compression mangles them.
+static const char* cookedMaps[] = { "map_Kd", "map_Ks", "map_Ka", "map_Ns" };
+
+/// <summary>
+/// Encodes a block of 16 single channel values as BC4, which is also the alpha half of BC3.
+/// Uses the 8 value mode, with the endpoints at the minimum and maximum.
+/// </summary>
+void encodeValues(const unsigned char _values[16], unsigned char* _output)
+{
+	unsigned char high = *std::max_element(_values, _values + 16);
+	unsigned char low = *std::min_element(_values, _values + 16);
+
+	_output[0] = high;
+	_output[1] = low;
+
+	//	Endpoints first, then 6 values in between.
+	int palette[8] = { high, low };
+	for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * high + (i - 1) * low + 3) / 7;
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 16 && high != low; i++)
+	{
+		int best = 0;
+		for (int j = 1; j < 8; j++)
+		{
+			if (std::abs(palette[j] - _values[i]) < std::abs(palette[best] - _values[i])) best = j;
+		}
+
+		indices |= (uint64_t)best << (i * 3);
+	}
+
+	for (int i = 0; i < 6; i++) _output[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+/// <summary>
+/// Packs a color into 5:6:5 bits.
+/// </summary>
+uint16_t pack565(const float _color[3])
+{
+	int r = (int)std::round(std::min(std::max(_color[0], 0.0f), 255.0f) * 31 / 255);
+	int g = (int)std::round(std::min(std::max(_color[1], 0.0f), 255.0f) * 63 / 255);
+	int b = (int)std::round(std::min(std::max(_color[2], 0.0f), 255.0f) * 31 / 255);
+
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void unpack565(uint16_t _packed, int _color[3])
+{
+	int r = (_packed >> 11) & 31, g = (_packed >> 5) & 63, b = _packed & 31;
+
+	_color[0] = (r << 3) | (r >> 2);
+	_color[1] = (g << 2) | (g >> 4);
+	_color[2] = (b << 3) | (b >> 2);
+}
+
+/// <summary>
+/// Encodes a block of 16 RGBA pixels as BC1, using the 4 color mode. The endpoints are the extremes of the pixels
+/// along their principal axis, which fits gradients far better than the corners of their bounding box.
+/// </summary>
+void encodeColors(const unsigned char _pixels[64], unsigned char* _output)
+{
+	//	Mean and covariance of the colors.
+	float mean[3] = {};
+	for (int i = 0; i < 16; i++) for (int c = 0; c < 3; c++) mean[c] += _pixels[i * 4 + c] / 16.0f;
+
+	float covariance[3][3] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float d[3] = { _pixels[i * 4] - mean[0], _pixels[i * 4 + 1] - mean[1], _pixels[i * 4 + 2] - mean[2] };
+		for (int a = 0; a < 3; a++) for (int b = 0; b < 3; b++) covariance[a][b] += d[a] * d[b];
+	}
+
+	//	Principal axis, through power iteration.
+	float axis[3] = { 1, 1, 1 };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[3] = {};
+		for (int a = 0; a < 3; a++) for (int b = 0; b < 3; b++) next[a] += covariance[a][b] * axis[b];
+
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f) break;
+
+		for (int a = 0; a < 3; a++) axis[a] = next[a] / length;
+	}
+
+	float lowest = 0, highest = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0;
+		for (int c = 0; c < 3; c++) t += (_pixels[i * 4 + c] - mean[c]) * axis[c];
+
+		lowest	= std::min(lowest, t);
+		highest	= std::max(highest, t);
+	}
+
+	float high[3], low[3];
+	for (int c = 0; c < 3; c++)
+	{
+		high[c]	= mean[c] + axis[c] * highest;
+		low[c]	= mean[c] + axis[c] * lowest;
+	}
+
+	//	The 4 color mode needs the first endpoint to be the larger one.
+	uint16_t color0 = pack565(high), color1 = pack565(low);
+	if (color0 < color1) std::swap(color0, color1);
+
+	int palette[4][3];
+	unpack565(color0, palette[0]);
+	unpack565(color1, palette[1]);
+
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+	}
+
+	uint32_t indices = 0;
+	for (int i = 0; i < 16 && color0 != color1; i++)
+	{
+		int best = 0, bestDistance = INT32_MAX;
+		for (int j = 0; j < 4; j++)
+		{
+			int distance = 0;
+			for (int c = 0; c < 3; c++) distance += (palette[j][c] - _pixels[i * 4 + c]) * (palette[j][c] - _pixels[i * 4 + c]);
+
+			if (distance < bestDistance)
+			{
+				best			= j;
+				bestDistance	= distance;
+			}
+		}
+
+		indices |= (uint32_t)best << (i * 2);
+	}
+
+	_output[0] = (unsigned char)color0;	_output[1] = (unsigned char)(color0 >> 8);
+	_output[2] = (unsigned char)color1;	_output[3] = (unsigned char)(color1 >> 8);
+
+	for (int i = 0; i < 4; i++) _output[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+/// <summary>
+/// Block compresses a single RGBA level.
+/// </summary>
+std::vector<unsigned char> compress(const unsigned char* _pixels, int _width, int _height, dds::Format _format)
+{
+	std::vector<unsigned char> output(dds::levelSize(_format, _width, _height));
+	unsigned char* block = output.data();
+
+	for (int y = 0; y < _height; y += 4)
+	{
+		for (int x = 0; x < _width; x += 4)
+		{
+			//	Gathering the block, blocks over the edge repeat the last row and column.
+			unsigned char pixels[64], alpha[16], red[16];
+			for (int i = 0; i < 16; i++)
+			{
+				int px = std::min(x + i % 4, _width - 1), py = std::min(y + i / 4, _height - 1);
+				memcpy(pixels + i * 4, _pixels + ((size_t)py * _width + px) * 4, 4);
+
+				red[i]		= pixels[i * 4];
+				alpha[i]	= pixels[i * 4 + 3];
+			}
+
+			switch (_format)
+			{
+				case dds::FORMAT_BC1:	encodeColors(pixels, block);								break;
+				case dds::FORMAT_BC3:	encodeValues(alpha, block); encodeColors(pixels, block + 8);	break;
+				case dds::FORMAT_BC4:	encodeValues(red, block);									break;
+			}
+
+			block += dds::blockSize(_format);
+		}
+	}
+
+	return output;
+}
+
+/// <summary>
+/// Cooks an image into a DDS file next to it, with its whole mip chain.
+/// </summary>
+/// <returns>Whether the image could be cooked.</returns>
+bool cook(const std::string& _path)
+{
+	int width, height, channels;
+	unsigned char* data = stbi_load(_path.c_str(), &width, &height, &channels, 4);
+
+	if (!data)
+	{
+		std::cout << "Error loading texture: " << _path << "." << std::endl;
+		return false;
+	}
+
+	dds::Image image;
+	image.width		= width;
+	image.height	= height;
+	image.format	= channels == 1 ? dds::FORMAT_BC4 : (channels == 3 ? dds::FORMAT_BC1 : dds::FORMAT_BC3);
+	sourcestamp::get(_path, image.sourceSize, image.sourceTime);
+
+	std::vector<unsigned char> level(data, data + (size_t)width * height * 4);
+	stbi_image_free(data);
+
+	while (true)
+	{
+		image.levels.push_back(compress(level.data(), width, height, image.format));
+		if (width == 1 && height == 1) break;
+
+		level = mipmap::downsample(level.data(), width, height, 4, width, height);
+	}
+
+	std::string cooked = dds::cookedPath(_path);
+	if (!dds::write(cooked, image))
+	{
+		std::cout << "Error writing " << cooked << "." << std::endl;
+		return false;
+	}
+
+	const char* formatNames[] = { "BC1", "BC3", "BC4" };
+	std::cout << _path << " -> " << cooked << " (" << formatNames[image.format] << ", " << image.levels.size() << " levels)" << std::endl;
+	return true;
+}
+
+/// <summary>
+/// Cooks the color maps a material refers to. Paths in a material are relative to it.
+/// </summary>
+bool cookMaterial(const std::string& _path)
+{
+	std::ifstream file(_path);
+	if (!file.is_open())
+	{
+		std::cout << "Error loading material: " << _path << "." << std::endl;
+		return false;
+	}
+
+	size_t slash			= _path.find_last_of("/\\");
+	std::string directory	= slash == std::string::npos ? "" : _path.substr(0, slash + 1);
+
+	bool succeeded = true;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string keyword, texture;
+		stream >> keyword >> texture;
+
+		for (const char* map : cookedMaps)
+		{
+			if (keyword == map && !texture.empty()) succeeded &= cook(directory + texture);
+		}
+	}
+
+	return succeeded;
+}
+
+/// <summary>
+/// Offline texture cooker. Converts images to block compressed DDS files with their mips prebuilt, which the
+/// renderer's texture loaders pick over the source image. Takes images and .mtl materials, relative to the working directory.
+/// </summary>
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: cooker <image or .mtl> ..." << std::endl;
+		return 1;
+	}
+
+	bool succeeded = true;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string path(argv[i]);
+		bool material = path.size() > 4 && path.compare(path.size() - 4, 4, ".mtl") == 0;
+
+		succeeded &= material ? cookMaterial(path) : cook(path);
+	}
+
+	return succeeded ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+
+#include "sourcestamp.h"
+
+namespace dds
+{
+	/// <summary>
+	/// Block compressed formats the cooker writes. BC1 for opaque color, BC3 for color with alpha, BC4 for single channel textures.
+	/// </summary>
+	enum Format { FORMAT_BC1, FORMAT_BC3, FORMAT_BC4 };
+
+	/// <summary>
+	/// Block compressed image with its whole mip chain, largest level first.
+	/// </summary>
+	struct Image
+	{
+		Format format	= FORMAT_BC1;
+		int width		= 0;
+		int height		= 0;
+
+		//	Size and modification time of the image it was cooked from, to tell when it's out of date.
+		uint64_t sourceSize	= 0;
+		int64_t sourceTime	= 0;
+
+		std::vector<std::vector<unsigned char>> levels;
+	};
+
+	/// <summary>
+	/// Bytes per 4x4 block.
+	/// </summary>
+	inline int blockSize(Format _format)
+	{
+		return _format == FORMAT_BC3 ? 16 : 8;
+	}
+
+	/// <summary>
+	/// Bytes a level of the given size takes up.
+	/// </summary>
+	inline size_t levelSize(Format _format, int _width, int _height)
+	{
+		return (size_t)((_width + 3) / 4) * ((_height + 3) / 4) * blockSize(_format);
+	}
+
+	/// <summary>
+	/// Where the cooked version of a source image lives: next to it, with the extension swapped for .dds.
+	/// </summary>
+	inline std::string cookedPath(const std::string& _source)
+	{
+		size_t dot		= _source.find_last_of('.');
+		size_t slash	= _source.find_last_of("/\\");
+
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return _source + ".dds";
+		return _source.substr(0, dot) + ".dds";
+	}
+
+	//	Layout of the legacy DDS header, which is enough for BC1 to BC4.
+	struct PixelFormat
+	{
+		uint32_t size, flags, fourCC, rgbBitCount, rMask, gMask, bMask, aMask;
+	};
+
+	struct Header
+	{
+		uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount;
+		uint32_t reserved1[11];	//	The source stamp goes here, behind a "SRC " tag.
+		PixelFormat pixelFormat;
+		uint32_t caps, caps2, caps3, caps4, reserved2;
+	};
+
+	inline uint32_t fourCC(const char* _code)
+	{
+		return (uint32_t)_code[0] | ((uint32_t)_code[1] << 8) | ((uint32_t)_code[2] << 16) | ((uint32_t)_code[3] << 24);
+	}
+
+	inline uint32_t fourCC(Format _format)
+	{
+		switch (_format)
+		{
+			case FORMAT_BC3:	return fourCC("DXT5");
+			case FORMAT_BC4:	return fourCC("ATI1");
+			default:			return fourCC("DXT1");
+		}
+	}
+
+	/// <summary>
+	/// Reads a cooked image.
+	/// </summary>
+	/// <returns>False if the file doesn't exist, or isn't a DDS file in one of our formats.</returns>
+	inline bool read(const std::string& _path, Image& _image)
+	{
+		std::ifstream file(_path, std::ios::binary);
+		if (!file.is_open()) return false;
+
+		char magic[4];
+		Header header;
+		file.read(magic, 4);
+		file.read((char*)&header, sizeof(Header));
+
+		if (!file || memcmp(magic, "DDS ", 4) != 0 || header.size != sizeof(Header)) return false;
+
+		uint32_t code = header.pixelFormat.fourCC;
+		if		(code == fourCC("DXT1"))	_image.format = FORMAT_BC1;
+		else if (code == fourCC("DXT5"))	_image.format = FORMAT_BC3;
+		else if (code == fourCC("ATI1"))	_image.format = FORMAT_BC4;
+		else								return false;
+
+		_image.width	= (int)header.width;
+		_image.height	= (int)header.height;
+
+		if (header.reserved1[0] == fourCC("SRC "))
+		{
+			memcpy(&_image.sourceSize, &header.reserved1[1], sizeof(uint64_t));
+			memcpy(&_image.sourceTime, &header.reserved1[3], sizeof(int64_t));
+		}
+		_image.levels.resize(header.mipMapCount > 0 ? header.mipMapCount : 1);
+
+		int width = _image.width, height = _image.height;
+		for (std::vector<unsigned char>& level : _image.levels)
+		{
+			level.resize(levelSize(_image.format, width, height));
+			file.read((char*)level.data(), level.size());
+
+			width	= width > 1 ? width / 2 : 1;
+			height	= height > 1 ? height / 2 : 1;
+		}
+
+		return (bool)file;
+	}
+
+	/// <summary>
+	/// Writes a cooked image.
+	/// </summary>
+	/// <returns>Whether the file could be written.</returns>
+	inline bool write(const std::string& _path, const Image& _image)
+	{
+		std::ofstream file(_path, std::ios::binary);
+		if (!file.is_open()) return false;
+
+		Header header = {};
+		header.size					= sizeof(Header);
+		header.flags				= 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;	//	Caps, height, width, pixel format, mip count, linear size.
+		header.height				= (uint32_t)_image.height;
+		header.width				= (uint32_t)_image.width;
+		header.pitchOrLinearSize	= (uint32_t)_image.levels[0].size();
+		header.mipMapCount			= (uint32_t)_image.levels.size();
+		header.pixelFormat.size		= sizeof(PixelFormat);
+		header.pixelFormat.flags	= 0x4;												//	Four CC.
+		header.pixelFormat.fourCC	= fourCC(_image.format);
+		header.caps					= 0x1000 | 0x400000 | 0x8;							//	Texture, mipmap, complex.
+		header.reserved1[0]			= fourCC("SRC ");
+		memcpy(&header.reserved1[1], &_image.sourceSize, sizeof(uint64_t));
+		memcpy(&header.reserved1[3], &_image.sourceTime, sizeof(int64_t));
+
+		file.write("DDS ", 4);
+		file.write((const char*)&header, sizeof(Header));
+		for (const std::vector<unsigned char>& level : _image.levels) file.write((const char*)level.data(), level.size());
+
+		return (bool)file;
+	}
+
+	/// <summary>
+	/// Reads the cooked version of a source image, if it was cooked from the source as it is now.
+	/// </summary>
+	/// <returns>False if there is no cooked image, or it is out of date, in which case the source should be loaded.</returns>
+	inline bool readCooked(const std::string& _source, Image& _image)
+	{
+		return read(cookedPath(_source), _image) && sourcestamp::current(_source, _image.sourceSize, _image.sourceTime);
+	}
+};
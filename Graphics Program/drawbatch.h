@@ -0,0 +1,228 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "renderstate.h"
+#include "shader.h"
+#include "model.h"
+
+//	GL 4.3 names. The loader only goes up to 3.3, so it might not define them.
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER		0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER	0x90D2
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+//	Shader storage binding point of the world matrices, and attribute location of the draw index. Match modelIndirect.vs.
+#define DRAW_BATCH_BINDING			1
+#define DRAW_BATCH_DRAW_ID_LOCATION	7
+
+typedef void (APIENTRY* MultiDrawElementsIndirectProc)(GLenum _mode, GLenum _type, const void* _indirect, GLsizei _drawCount, GLsizei _stride);
+
+/// <summary>
+/// A command of glMultiDrawElementsIndirect, as it's laid out in the indirect buffer.
+/// </summary>
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+/// <summary>
+/// Collects the models drawn during a pass and submits them through glMultiDrawElementsIndirect, with one call per run of
+/// meshes that share a geometry pool and textures, however many objects there are. The world matrices go into a shader storage buffer
+/// that the shader indexes with the draw's base instance, which reaches it through an instanced attribute.
+/// Needs GL 4.3. On older contexts supported stays false, and objects draw themselves one mesh at a time.
+/// </summary>
+class DrawBatch
+{
+public:
+	bool supported = false;
+
+	//	Profiling counters.
+	unsigned long long submittedDraws	= 0;
+	unsigned long long issuedCalls		= 0;
+
+	static DrawBatch& get()
+	{
+		static DrawBatch batch;
+		return batch;
+	}
+
+	/// <summary>
+	/// Looks up glMultiDrawElementsIndirect, which the loader doesn't, and sets up the batch if the context has it.
+	/// Call this once after the loader, with the same function.
+	/// </summary>
+	void load(GLADloadproc _load)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major * 10 + minor < 43) return;
+
+		multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)_load("glMultiDrawElementsIndirect");
+		if (multiDrawElementsIndirect == NULL) return;
+
+		shader = new Shader("shaders/modelIndirect.vs", "shaders/model.fs");
+
+		GLint linked = GL_FALSE;
+		glGetProgramiv(shader->id, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) return;
+
+		glGenBuffers(1, &drawIdBuffer);
+		glGenBuffers(1, &worldBuffer);
+		glGenBuffers(1, &commandBuffer);
+
+		supported = true;
+	}
+
+	/// <summary>
+	/// Queues every mesh of a model, to be drawn with the world matrix on the next flush.
+	/// </summary>
+	void add(Model& _model, const glm::mat4& _world)
+	{
+		if (!_model.loaded) return;
+
+		GLuint world = (GLuint)worlds.size();
+		worlds.push_back(_world);
+
+		for (Mesh& mesh : _model.meshes) draws.push_back({ &mesh, world });
+	}
+
+	/// <summary>
+	/// Draws everything that was queued since the last flush, with the same state objects draw with.
+	/// </summary>
+	void flush()
+	{
+		if (draws.empty()) return;
+
+		//	Meshes that can share a call end up next to each other.
+		std::stable_sort(draws.begin(), draws.end(), [](const Draw& _a, const Draw& _b)
+		{
+			if (_a.mesh->geometry.vertexArray != _b.mesh->geometry.vertexArray) return _a.mesh->geometry.vertexArray < _b.mesh->geometry.vertexArray;
+			return _a.mesh->texturesBefore(*_b.mesh);
+		});
+
+		//	A draw's base instance is its index, so it picks up its own world matrix.
+		commands.resize(draws.size());
+		drawWorlds.resize(draws.size());
+		for (size_t i = 0; i < draws.size(); i++)
+		{
+			const GeometryAllocation& geometry = draws[i].mesh->geometry;
+
+			commands[i]		= { geometry.indexCount, 1, (GLuint)geometry.firstIndex, geometry.baseVertex, (GLuint)i };
+			drawWorlds[i]	= worlds[draws[i].world];
+		}
+
+		reserveDrawIds(draws.size());
+
+		//	Orphaning last pass' storage, so we don't wait on draws still reading it.
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, worldBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawWorlds.size() * sizeof(glm::mat4), drawWorlds.data(), GL_STREAM_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_BATCH_BINDING, worldBuffer);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+
+		RenderState& state = RenderState::get();
+		state.disable(GL_BLEND);
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+		state.useProgram(shader->id);
+
+		for (size_t first = 0; first < draws.size();)
+		{
+			Mesh& mesh = *draws[first].mesh;
+
+			size_t last = first + 1;
+			while (last < draws.size() && draws[last].mesh->geometry.vertexArray == mesh.geometry.vertexArray && draws[last].mesh->sameTextures(mesh)) last++;
+
+			mesh.bindTextures(shader->id);
+			bindVertexArray(mesh.geometry.vertexArray);
+
+			multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(first * sizeof(DrawElementsIndirectCommand)), (GLsizei)(last - first), 0);
+			issuedCalls++;
+
+			first = last;
+		}
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		submittedDraws += draws.size();
+		draws.clear();
+		worlds.clear();
+	}
+
+private:
+	struct Draw
+	{
+		Mesh* mesh;
+		GLuint world;
+	};
+
+	MultiDrawElementsIndirectProc multiDrawElementsIndirect = NULL;
+	Shader* shader = NULL;
+
+	std::vector<Draw> draws;
+	std::vector<glm::mat4> worlds, drawWorlds;
+	std::vector<DrawElementsIndirectCommand> commands;
+
+	//	Holds 0, 1, 2, ... for the draw index attribute.
+	GLuint drawIdBuffer		= 0;
+	size_t drawIdCapacity	= 0;
+
+	GLuint worldBuffer		= 0;
+	GLuint commandBuffer	= 0;
+
+	//	Vertex arrays that have the draw index attribute.
+	std::vector<GLuint> configuredArrays;
+
+	DrawBatch() {}
+
+	/// <summary>
+	/// Grows the draw index buffer to hold at least _count indices. Vertex arrays refer to the buffer by name, so they keep working.
+	/// </summary>
+	void reserveDrawIds(size_t _count)
+	{
+		if (_count <= drawIdCapacity) return;
+
+		drawIdCapacity = std::max(_count, drawIdCapacity * 2);
+
+		std::vector<GLuint> ids(drawIdCapacity);
+		for (size_t i = 0; i < ids.size(); i++) ids[i] = (GLuint)i;
+
+		glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+		glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	/// <summary>
+	/// Binds a geometry pool's vertex array, adding the draw index attribute the first time. Shaders that don't read it ignore it.
+	/// </summary>
+	void bindVertexArray(GLuint _vertexArray)
+	{
+		RenderState::get().bindVertexArray(_vertexArray);
+		if (std::find(configuredArrays.begin(), configuredArrays.end(), _vertexArray) != configuredArrays.end()) return;
+
+		glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+		glEnableVertexAttribArray(DRAW_BATCH_DRAW_ID_LOCATION);
+		glVertexAttribIPointer(DRAW_BATCH_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+		glVertexAttribDivisor(DRAW_BATCH_DRAW_ID_LOCATION, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		configuredArrays.push_back(_vertexArray);
+	}
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+/// <summary>
+/// The six planes of a view volume, used to cull bounding boxes before drawing them.
+/// </summary>
+class Frustum
+{
+public:
+	//	Left, right, bottom, top, near, far. (xyz = inward facing normal, w = distance)
+	glm::vec4 planes[6];
+
+	/// <summary>
+	/// Extracts the planes from a projection * view matrix, so they are in world space.
+	/// </summary>
+	void extract(const glm::mat4& _viewProjection)
+	{
+		//	glm is column major, so rows have to be gathered by hand.
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++) rows[i] = glm::vec4(_viewProjection[0][i], _viewProjection[1][i], _viewProjection[2][i], _viewProjection[3][i]);
+
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[3] + rows[2];
+		planes[5] = rows[3] - rows[2];
+
+		for (int i = 0; i < 6; i++) planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	/// <summary>
+	/// Returns false if the box is fully outside of the frustum. Boxes near a corner may be kept even though they are outside.
+	/// </summary>
+	bool intersects(const glm::vec3& _min, const glm::vec3& _max) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			//	The corner furthest along the plane normal.
+			glm::vec3 corner(planes[i].x > 0 ? _max.x : _min.x, planes[i].y > 0 ? _max.y : _min.y, planes[i].z > 0 ? _max.z : _min.z);
+
+			if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0) return false;
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Returns false if the sphere is fully outside of the frustum.
+	/// </summary>
+	bool intersects(const glm::vec3& _center, float _radius) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(planes[i]), _center) + planes[i].w < -_radius) return false;
+		}
+
+		return true;
+	}
+};
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "renderstate.h"
+#include "vertexformat.h"
+
+//	Size a pool's buffers start out at. They double whenever an allocation doesn't fit.
+#define GEOMETRY_POOL_VERTEX_BYTES	(4 << 20)
+#define GEOMETRY_POOL_INDEX_BYTES	(1 << 20)
+
+/// <summary>
+/// First fit allocator over a range of elements. Freed ranges are merged with their free neighbours.
+/// </summary>
+class RangeAllocator
+{
+public:
+	size_t capacity = 0;
+
+	/// <summary>
+	/// Returns the first element of _count free elements, or SIZE_MAX if no free range is large enough.
+	/// </summary>
+	size_t allocate(size_t _count)
+	{
+		if (_count == 0) return 0;
+
+		for (auto it = ranges.begin(); it != ranges.end(); it++)
+		{
+			if (it->second < _count) continue;
+
+			size_t first = it->first, remaining = it->second - _count;
+			ranges.erase(it);
+			if (remaining > 0) ranges[first + _count] = remaining;
+
+			return first;
+		}
+
+		return SIZE_MAX;
+	}
+
+	void free(size_t _first, size_t _count)
+	{
+		if (_count == 0) return;
+
+		auto next = ranges.lower_bound(_first);
+		if (next != ranges.end() && _first + _count == next->first)
+		{
+			_count += next->second;
+			next = ranges.erase(next);
+		}
+
+		if (next != ranges.begin())
+		{
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == _first)
+			{
+				previous->second += _count;
+				return;
+			}
+		}
+
+		ranges[_first] = _count;
+	}
+
+	/// <summary>
+	/// Adds free elements to the end of the range.
+	/// </summary>
+	void grow(size_t _capacity)
+	{
+		free(capacity, _capacity - capacity);
+		capacity = _capacity;
+	}
+
+private:
+	//	First element and count of every free range.
+	std::map<size_t, size_t> ranges;
+};
+
+/// <summary>
+/// Where a mesh's vertices and indices live in the geometry pool.
+/// </summary>
+struct GeometryAllocation
+{
+	int pool					= -1;
+	GLuint vertexArray			= 0;
+	GLint baseVertex			= 0;
+	size_t firstIndex			= 0;
+	unsigned int vertexCount	= 0;
+	unsigned int indexCount		= 0;
+
+	/// <summary>
+	/// Returns the offset of the first index, as glDrawElementsBaseVertex takes it.
+	/// </summary>
+	const void* indexOffset() const
+	{
+		return (const void*)(firstIndex * sizeof(unsigned int));
+	}
+};
+
+/// <summary>
+/// Shared vertex and index buffers that static meshes are sub allocated from. There's one pool per vertex layout, each with
+/// a single vertex array, so meshes of the same layout are drawn with glDrawElementsBaseVertex without switching vertex arrays.
+/// Buffers that run out of space are replaced by one twice the size, which keeps the vertex array and every allocation's offsets.
+/// </summary>
+class GeometryPool
+{
+public:
+	static GeometryPool& get()
+	{
+		static GeometryPool pool;
+		return pool;
+	}
+
+	/// <summary>
+	/// Sub allocates a mesh and uploads its vertices and indices. Call this from the main thread.
+	/// </summary>
+	/// <param name="_vertices">Vertices laid out as _layout describes.</param>
+	GeometryAllocation allocate(const VertexLayout& _layout, const void* _vertices, unsigned int _vertexCount, const unsigned int* _indices, unsigned int _indexCount)
+	{
+		GeometryAllocation allocation;
+		allocation.pool			= poolOf(_layout);
+		allocation.vertexCount	= _vertexCount;
+		allocation.indexCount	= _indexCount;
+
+		Pool& pool = pools[allocation.pool];
+		allocation.vertexArray	= pool.vertexArray;
+		allocation.baseVertex	= (GLint)reserve(pool, pool.vertexBuffer, pool.vertices, _layout.stride, GEOMETRY_POOL_VERTEX_BYTES, _vertexCount);
+		allocation.firstIndex	= reserve(pool, pool.indexBuffer, pool.indices, sizeof(unsigned int), GEOMETRY_POOL_INDEX_BYTES, _indexCount);
+
+		//	The copy target leaves the bound vertex array's element buffer alone.
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)allocation.baseVertex * _layout.stride, (GLsizeiptr)_vertexCount * _layout.stride, _vertices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)allocation.firstIndex * sizeof(unsigned int), (GLsizeiptr)_indexCount * sizeof(unsigned int), _indices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		return allocation;
+	}
+
+	/// <summary>
+	/// Returns a mesh's space to its pool. The buffers keep their size.
+	/// </summary>
+	void free(const GeometryAllocation& _allocation)
+	{
+		if (_allocation.pool < 0) return;
+
+		Pool& pool = pools[_allocation.pool];
+		pool.vertices.free((size_t)_allocation.baseVertex, _allocation.vertexCount);
+		pool.indices.free(_allocation.firstIndex, _allocation.indexCount);
+	}
+
+	/// <summary>
+	/// Returns the size of every pool's buffers, in bytes.
+	/// </summary>
+	size_t bytes() const
+	{
+		size_t total = 0;
+		for (const Pool& pool : pools) total += pool.vertices.capacity * pool.layout.stride + pool.indices.capacity * sizeof(unsigned int);
+
+		return total;
+	}
+
+	size_t poolCount() const
+	{
+		return pools.size();
+	}
+
+private:
+	struct Pool
+	{
+		VertexLayout layout;
+		GLuint vertexArray	= 0;
+		GLuint vertexBuffer	= 0;
+		GLuint indexBuffer	= 0;
+		RangeAllocator vertices, indices;
+	};
+
+	std::vector<Pool> pools;
+
+	GeometryPool() {}
+
+	/// <summary>
+	/// Returns the pool of a layout, creating it the first time the layout is used.
+	/// </summary>
+	int poolOf(const VertexLayout& _layout)
+	{
+		for (size_t i = 0; i < pools.size(); i++)
+		{
+			if (pools[i].layout == _layout) return (int)i;
+		}
+
+		Pool pool;
+		pool.layout = _layout;
+		glGenVertexArrays(1, &pool.vertexArray);
+		pools.push_back(pool);
+
+		return (int)pools.size() - 1;
+	}
+
+	/// <summary>
+	/// Allocates elements from one of a pool's buffers, growing the buffer when they don't fit.
+	/// </summary>
+	size_t reserve(Pool& _pool, GLuint& _buffer, RangeAllocator& _allocator, size_t _elementSize, size_t _initialBytes, size_t _count)
+	{
+		size_t first = _allocator.allocate(_count);
+		if (first != SIZE_MAX) return first;
+
+		size_t capacity = std::max(std::max(_allocator.capacity * 2, _initialBytes / _elementSize), _allocator.capacity + _count);
+
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * _elementSize, NULL, GL_STATIC_DRAW);
+
+		if (_buffer != 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, _buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, _allocator.capacity * _elementSize);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glDeleteBuffers(1, &_buffer);
+		}
+
+		_buffer = buffer;
+		_allocator.grow(capacity);
+
+		//	Pointing the vertex array at the new buffer.
+		RenderState::get().bindVertexArray(_pool.vertexArray);
+		if (_pool.vertexBuffer != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, _pool.vertexBuffer);
+			_pool.layout.apply();
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		if (_pool.indexBuffer != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _pool.indexBuffer);
+		RenderState::get().bindVertexArray(0);
+
+		return _allocator.allocate(_count);
+	}
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/// <summary>
+/// Counts the bytes allocated through operator new, so benchmarks can measure the memory peak of an operation.
+/// The counting operators themselves are defined once, in main.cpp, and only when HEAP_TRACKING is defined,
+/// since they add a header and two atomics to every allocation. Without it, current and peak stay at 0.
+/// </summary>
+namespace heap
+{
+#ifdef HEAP_TRACKING
+	const bool tracking = true;
+#else
+	const bool tracking = false;
+#endif
+
+	inline std::atomic<size_t>& currentBytes()
+	{
+		static std::atomic<size_t> bytes(0);
+		return bytes;
+	}
+
+	inline std::atomic<size_t>& peakBytes()
+	{
+		static std::atomic<size_t> bytes(0);
+		return bytes;
+	}
+
+	inline void allocated(size_t _size)
+	{
+		size_t now	= currentBytes().fetch_add(_size, std::memory_order_relaxed) + _size;
+		size_t peak	= peakBytes().load(std::memory_order_relaxed);
+
+		while (now > peak && !peakBytes().compare_exchange_weak(peak, now, std::memory_order_relaxed));
+	}
+
+	inline void freed(size_t _size)
+	{
+		currentBytes().fetch_sub(_size, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Bytes allocated right now.
+	/// </summary>
+	inline size_t current()
+	{
+		return currentBytes().load(std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Most bytes allocated at once since the last resetPeak.
+	/// </summary>
+	inline size_t peak()
+	{
+		return peakBytes().load(std::memory_order_relaxed);
+	}
+
+	inline void resetPeak()
+	{
+		peakBytes().store(current(), std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "renderstate.h"
+#include "projection.h"
+#include "model.h"
+
+//	First attribute locations of the instance's world matrix, which takes up four, and its normal matrix, which takes up three. Match modelInstanced.vs.
+#define INSTANCE_WORLD_LOCATION		8
+#define INSTANCE_NORMAL_LOCATION	12
+
+/// <summary>
+/// Attributes of an instance, as they are streamed to the instance buffer.
+/// </summary>
+struct Instance
+{
+	glm::mat4 world;
+	glm::mat3 normal;	//	Inverse transpose of the world matrix's rotation and scale, so normals stay right under non uniform scales.
+};
+
+/// <summary>
+/// Many copies of one model, each with its own world matrix. The model is loaded and uploaded once, and every mesh is drawn
+/// with a single instanced draw. Instances outside the view are culled against the model's bounding sphere, and the rest
+/// are uploaded to a per instance attribute buffer every draw.
+/// </summary>
+class InstancedObject
+{
+public:
+	Model* model;
+
+	//	Profiling counter, instances drawn by the last draw.
+	unsigned int visibleInstances = 0;
+
+	InstancedObject(string const& _path)
+	{
+		shader = new Shader("shaders/modelInstanced.vs", "shaders/model.fs");
+		model = new Model(_path, false, true, false, shader->attributes);
+
+		glGenBuffers(1, &instanceBuffer);
+	}
+
+	~InstancedObject()
+	{
+		//	The model's worker and upload still point at it until they're done.
+		if (!model->loaded) jobs::JobSystem::get().finish();
+
+		delete model;
+		delete shader;
+		glDeleteBuffers(1, &instanceBuffer);
+	}
+
+	/// <summary>
+	/// Adds an instance. Its normal matrix is worked out here, once, instead of for every vertex.
+	/// </summary>
+	void add(const glm::mat4& _world)
+	{
+		instances.push_back({ _world, glm::transpose(glm::inverse(glm::mat3(_world))) });
+	}
+
+	void clear()
+	{
+		instances.clear();
+	}
+
+	/// <summary>
+	/// Draws the instances that are inside the projection's frustum.
+	/// </summary>
+	void draw(const Projection* _projection)
+	{
+		visibleInstances = 0;
+		if (!model->loaded || instances.empty()) return;
+
+		//	Culling against the bounding sphere, scaled by the largest axis of the instance.
+		glm::vec3 center;
+		float radius;
+		model->boundingSphere(center, radius);
+
+		visible.clear();
+		for (const Instance& instance : instances)
+		{
+			const glm::mat4& world = instance.world;
+			float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+			if (_projection->frustum.intersects(glm::vec3(world * glm::vec4(center, 1.0f)), radius * scale)) visible.push_back(instance);
+		}
+
+		if (visible.empty()) return;
+		visibleInstances = (unsigned int)visible.size();
+
+		//	Orphaning the last draw's instances, so we don't wait on draws still reading them.
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, visible.size() * sizeof(Instance), visible.data(), GL_STREAM_DRAW);
+
+		RenderState& state = RenderState::get();
+		state.disable(GL_BLEND);
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+		state.useProgram(shader->id);
+
+		//	Vertex arrays are shared by every mesh of a layout, so the instance attributes are only set for the draw, and turned off after it.
+		for (Mesh& mesh : model->meshes)
+		{
+			state.bindVertexArray(mesh.geometry.vertexArray);
+			setInstanceAttributes(true);
+
+			mesh.DrawInstanced(shader->id, visibleInstances);
+
+			setInstanceAttributes(false);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+private:
+	Shader* shader;
+	GLuint instanceBuffer;
+
+	std::vector<Instance> instances;
+
+	//	Instances that passed the culling, reused between draws.
+	std::vector<Instance> visible;
+
+	/// <summary>
+	/// Points the bound vertex array's instance attributes at the instance buffer, a column per location, or disables them.
+	/// </summary>
+	void setInstanceAttributes(bool _enabled)
+	{
+		//	Four columns of the world matrix, then three of the normal matrix.
+		for (GLuint i = 0; i < 7; i++)
+		{
+			GLuint location = i < 4 ? INSTANCE_WORLD_LOCATION + i : INSTANCE_NORMAL_LOCATION + i - 4;
+			if (!_enabled)
+			{
+				glDisableVertexAttribArray(location);
+				continue;
+			}
+
+			GLint components	= i < 4 ? 4 : 3;
+			size_t offset		= i < 4 ? i * sizeof(glm::vec4) : offsetof(Instance, normal) + (i - 4) * sizeof(glm::vec3);
+
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, components, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offset);
+			glVertexAttribDivisor(location, 1);
+		}
+	}
+};
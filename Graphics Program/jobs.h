@@ -0,0 +1,193 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+namespace jobs
+{
+	/// <summary>
+	/// Amount of threads work is spread over, including the calling one.
+	/// </summary>
+	inline int threadCount()
+	{
+		return std::max((int)std::thread::hardware_concurrency(), 1);
+	}
+
+	/// <summary>
+	/// Runs a job for every index in [0, count) spread over all cores, and returns once all of them are done.
+	/// Indices are handed out one at a time, so jobs of uneven size still balance out.
+	/// </summary>
+	/// <param name="count">Amount of jobs.</param>
+	/// <param name="job">Callable taking the index, has to be safe to run concurrently.</param>
+	template <typename Job>
+	inline void parallelFor(int count, const Job& job)
+	{
+		std::atomic<int> next(0);
+		auto worker = [&]()
+		{
+			for (int i = next++; i < count; i = next++) job(i);
+		};
+
+		//	The calling thread works along instead of waiting.
+		std::vector<std::thread> threads;
+		for (int i = 1; i < std::min(threadCount(), count); i++) threads.emplace_back(worker);
+
+		worker();
+
+		for (std::thread& thread : threads) thread.join();
+	}
+
+	/// <summary>
+	/// Pool of worker threads for background work like asset loading, plus a queue of jobs that have to run on the
+	/// main thread, like GL uploads. Workers hand their results over to the main thread through that queue.
+	/// </summary>
+	class JobSystem
+	{
+	public:
+		static JobSystem& get()
+		{
+			static JobSystem system;
+			return system;
+		}
+
+		/// <summary>
+		/// Runs a job on a worker thread.
+		/// </summary>
+		void async(std::function<void()> _job)
+		{
+			pending++;
+			{
+				std::lock_guard<std::mutex> lock(workerMutex);
+				workerJobs.push(std::move(_job));
+			}
+			workerSignal.notify_one();
+		}
+
+		/// <summary>
+		/// Queues a job for the main thread, it runs during the next runMainThreadJobs.
+		/// </summary>
+		void onMainThread(std::function<void()> _job)
+		{
+			pending++;
+			{
+				std::lock_guard<std::mutex> lock(mainMutex);
+				mainJobs.push(std::move(_job));
+			}
+			mainSignal.notify_one();
+		}
+
+		/// <summary>
+		/// Runs the jobs queued for the main thread so far. Call this from the main thread, once per frame.
+		/// </summary>
+		/// <returns>The amount of jobs that ran.</returns>
+		int runMainThreadJobs()
+		{
+			std::queue<std::function<void()>> ready;
+			{
+				std::lock_guard<std::mutex> lock(mainMutex);
+				std::swap(ready, mainJobs);
+			}
+
+			int count = (int)ready.size();
+			for (; !ready.empty(); ready.pop())
+			{
+				ready.front()();
+				pending--;
+			}
+
+			return count;
+		}
+
+		/// <summary>
+		/// Returns true while any job, on any thread, hasn't finished yet.
+		/// </summary>
+		bool busy() const
+		{
+			return pending > 0;
+		}
+
+		/// <summary>
+		/// Blocks the main thread until every job is done, running main thread jobs as they come in.
+		/// </summary>
+		void finish()
+		{
+			while (busy())
+			{
+				if (runMainThreadJobs() > 0) continue;
+
+				std::unique_lock<std::mutex> lock(mainMutex);
+				mainSignal.wait_for(lock, std::chrono::milliseconds(1), [this]() { return !mainJobs.empty() || !busy(); });
+			}
+		}
+
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> workerJobs, mainJobs;
+		std::mutex workerMutex, mainMutex;
+		std::condition_variable workerSignal, mainSignal;
+
+		std::atomic<int> pending;
+		bool stopping = false;
+
+		JobSystem() : pending(0)
+		{
+			//	The main thread is busy rendering, so it doesn't count.
+			for (int i = 0; i < std::max(threadCount() - 1, 1); i++) workers.emplace_back([this]() { work(); });
+		}
+
+		~JobSystem()
+		{
+			{
+				std::lock_guard<std::mutex> lock(workerMutex);
+				stopping = true;
+			}
+			workerSignal.notify_all();
+
+			for (std::thread& worker : workers) worker.join();
+		}
+
+		void work()
+		{
+			while (true)
+			{
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(workerMutex);
+					workerSignal.wait(lock, [this]() { return stopping || !workerJobs.empty(); });
+
+					if (stopping) return;
+
+					job = std::move(workerJobs.front());
+					workerJobs.pop();
+				}
+
+				job();
+				pending--;
+				mainSignal.notify_one();
+			}
+		}
+	};
+
+	/// <summary>
+	/// Runs a job on a worker thread of the shared JobSystem.
+	/// </summary>
+	inline void async(std::function<void()> job)
+	{
+		JobSystem::get().async(std::move(job));
+	}
+
+	/// <summary>
+	/// Queues a job for the main thread of the shared JobSystem.
+	/// </summary>
+	inline void onMainThread(std::function<void()> job)
+	{
+		JobSystem::get().onMainThread(std::move(job));
+	}
+};
@@ -1,5 +1,10 @@
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <new>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -9,6 +14,14 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+//	Headless mode uses a surfaceless EGL context where available (Mesa, NVIDIA), and a hidden GLFW window otherwise.
+//	The EGL context is opt in, since the Visual Studio configurations don't link EGL: define HEADLESS_EGL and link libEGL,
+//	e.g. "g++ -DHEADLESS_EGL ... -lEGL -lOpenGL" on Linux. Without it, --headless still works, but needs a display for its window.
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include "util.h"
 
 #include "camera.h"
@@ -17,6 +30,15 @@
 #include "object.h"
 #include "portal.h"
 #include "projection.h"
+#include "shader.h"
+#include "renderstate.h"
+#include "benchmark.h"
+#include "jobs.h"
+#include "texturestream.h"
+#include "geometrypool.h"
+#include "drawbatch.h"
+#include "instancedobject.h"
+#include "heap.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -24,12 +46,65 @@
 //	Fancy namespaces:
 using namespace util;
 
+//	Heap tracking: every allocation is prefixed with its size, so it can be counted in heap::current and heap::peak.
+//	Only built with HEAP_TRACKING defined, e.g. /D HEAP_TRACKING for benchmark builds.
+#ifdef HEAP_TRACKING
+#define HEAP_HEADER alignof(std::max_align_t)
+
+void* operator new(size_t _size, const std::nothrow_t&) noexcept
+{
+	void* block = malloc(_size + HEAP_HEADER);
+	if (block == NULL) return NULL;
+
+	*(size_t*)block = _size;
+	heap::allocated(_size);
+
+	return (char*)block + HEAP_HEADER;
+}
+
+void* operator new(size_t _size)
+{
+	void* pointer = operator new(_size, std::nothrow);
+	if (pointer == NULL) throw std::bad_alloc();
+
+	return pointer;
+}
+
+void operator delete(void* _pointer) noexcept
+{
+	if (_pointer == NULL) return;
+
+	void* block = (char*)_pointer - HEAP_HEADER;
+	heap::freed(*(size_t*)block);
+	free(block);
+}
+
+void* operator new[](size_t _size)										{ return operator new(_size); }
+void* operator new[](size_t _size, const std::nothrow_t&) noexcept		{ return operator new(_size, std::nothrow); }
+void operator delete[](void* _pointer) noexcept							{ operator delete(_pointer); }
+void operator delete(void* _pointer, size_t) noexcept					{ operator delete(_pointer); }
+void operator delete[](void* _pointer, size_t) noexcept					{ operator delete(_pointer); }
+void operator delete(void* _pointer, const std::nothrow_t&) noexcept	{ operator delete(_pointer); }
+void operator delete[](void* _pointer, const std::nothrow_t&) noexcept	{ operator delete(_pointer); }
+#endif
+
 //	Main:
 int init(GLFWwindow*& window);
+int initHeadless(GLFWwindow*& window);
+void parseArguments(int argc, char* argv[]);
 
 //	Rendering:
+void renderFrame();
 void switchToBuffer(unsigned int buffer);
-void drawObjects(Projection* _projection);
+void drawPortalView(Portal* _portal, unsigned int _buffer);
+void drawStencilPortalView(Portal* _portal);
+void drawObjects(Projection* _projection, bool _clear = true);
+void benchmarkTerrainQueries();
+void benchmarkModelLoads();
+void benchmarkBatchedDraws();
+void benchmarkInstancedDraws();
+void beginPass(int _pass);
+void endPass(int _pass);
 
 //	Input:
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -38,90 +113,306 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 //	Window:
 const int width = 1280, height = 720;
 
+//	Command line options:
+bool headless			= false;
+int benchmarkFrames		= 0;
+int warmupFrames		= 10;
+const char* reportPath	= "benchmark.json";
+bool stencilPortals		= false;
+int portalDepth			= 3;
+
+//	Benchmark passes:
+enum Pass { PASS_PORTAL_A, PASS_PORTAL_B, PASS_MAIN };
+Benchmark* benchmark = NULL;
+
 //	Objects:
-Camera*		camera;
-Skybox*		skybox;
-Terrain*	terrain;
-Portal*		portalA;
-Portal*		portalB;
+Camera*			camera;
+FrameUniforms*	frameUniforms;
+Skybox*			skybox;
+Terrain*		terrain;
+Portal*			portalA;
+Portal*			portalB;
 
 //	Framebuffer stuff
 unsigned int portalBufA, portalColorBufA, portalDepthBufA;
 unsigned int portalBufB, portalColorBufB, portalDepthBufB;
 
-int main()
+//	Main target. Zero is the window, headless mode renders into an offscreen buffer instead.
+unsigned int mainBuf = 0, mainColorBuf, mainDepthBuf;
+
+int main(int argc, char* argv[])
 {
-	//	Initialize the window.
+	parseArguments(argc, argv);
+
+	//	Initialize the window, or an offscreen context.
 	GLFWwindow* window = NULL;
-	if (init(window) < 0) return -1;
+	if (headless)
+	{
+		if (initHeadless(window) < 0) return -1;
+	}
+	else
+	{
+		if (init(window) < 0) return -1;
+	}
 
 	//	Checking OpenGL and GLSL versions, and active GPU
 	std::cout << "OpenGL version: "	<< glGetString(GL_VERSION)					<< std::endl;
 	std::cout << "GLSL version: "	<< glGetString(GL_SHADING_LANGUAGE_VERSION)	<< std::endl;
 	std::cout << "Renderer: "		<< glGetString(GL_RENDERER)					<< std::endl;
 
-	//	Setting framerate cap.
-	glfwSwapInterval(1);
+	//	Setting framerate cap. Benchmarks run uncapped.
+	if (window != NULL) glfwSwapInterval(benchmarkFrames > 0 ? 0 : 1);
 
 	//	Creating a portal.
-	camera		= new Camera(width, height);
-	skybox		= new Skybox();
-	terrain		= new Terrain();
-	portalA		= new Portal(camera, glm::vec3(1000, 500, 1000), 100);
-	portalB		= new Portal(camera, glm::vec3(2000, 250, 2000), 100);
+	auto startupStart = std::chrono::high_resolution_clock::now();
+
+	camera			= new Camera(width, height);
+	frameUniforms	= new FrameUniforms();
+	skybox			= new Skybox();
+	terrain			= new Terrain();
+	portalA			= new Portal(camera, glm::vec3(1000, 500, 1000), 100);
+	portalB			= new Portal(camera, glm::vec3(2000, 250, 2000), 100);
 
 	//	Linking portals.
 	portalA->linkedPortal = portalB;
 	portalB->linkedPortal = portalA;
 
-	//	Creating portal buffers.
-	createFrameBuffer(width, height, portalBufA, portalColorBufA, portalDepthBufA);
-	createFrameBuffer(width, height, portalBufB, portalColorBufB, portalDepthBufB);
+	portalA->maxDepth = portalB->maxDepth = portalDepth;
+
+	//	Creating portal buffers. Stencil portals draw their views into the main buffer, so they don't need any.
+	if (stencilPortals)
+	{
+		portalA->stencilReference = 1;
+		portalB->stencilReference = 2;
+	}
+	else
+	{
+		createFrameBuffer(width, height, portalBufA, portalColorBufA, portalDepthBufA);
+		createFrameBuffer(width, height, portalBufB, portalColorBufB, portalDepthBufB);
+	}
+
+	//	Creating the offscreen main buffer, with a stencil buffer for the stencil portals.
+	if (headless) createFrameBuffer(width, height, mainBuf, mainColorBuf, mainDepthBuf, true);
+
+	//	Assets keep loading in the background from here on.
+	double constructionMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupStart).count();
+
+	//	Setting up the benchmark.
+	if (benchmarkFrames > 0)
+	{
+		//	Recorded frames should show the whole scene, so wait for every asset.
+		jobs::JobSystem::get().finish();
+		TextureStream::get().flush();
+		glFinish();
+
+		benchmark = new Benchmark(benchmarkFrames, warmupFrames, { "portalA", "portalB", "main" });
+		benchmark->setMetric("constructionMs", constructionMs);
+		benchmark->setMetric("startupMs", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupStart).count());
+		benchmark->setMetric("terrainGenerationMs", terrain->generationMs);
+		benchmark->setMetric("jobThreads", jobs::threadCount());
+		benchmark->setMetric("stencilPortals", stencilPortals ? 1 : 0);
+		benchmark->setMetric("portalDepth", portalDepth);
+		benchmark->setMetric("textureUploadBytes", (double)TextureStream::get().uploadedBytes);
+		benchmark->setMetric("compressedTextures", TextureStream::get().compressedTextures);
+		benchmark->setMetric("portalModelCpuBytes", (double)(portalA->sphere->cpuBytes() + portalB->sphere->cpuBytes()));
+		benchmark->setMetric("portalModelGpuBytes", (double)(portalA->sphere->gpuBytes() + portalB->sphere->gpuBytes()));
+		benchmark->setMetric("geometryPools", (double)GeometryPool::get().poolCount());
+		benchmark->setMetric("geometryPoolBytes", (double)GeometryPool::get().bytes());
+
+		benchmarkTerrainQueries();
+		benchmarkModelLoads();
+		benchmarkBatchedDraws();
+		benchmarkInstancedDraws();
+	}
 
 	//	Game loop.
-	while (!glfwWindowShouldClose(window))
+	while (benchmark != NULL ? !benchmark->finished() : !glfwWindowShouldClose(window))
 	{
-		//	Close window if escape is pressed.
-		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+		//	Uploading whatever finished loading since the last frame.
+		jobs::JobSystem::get().runMainThreadJobs();
+		TextureStream::get().update();
+
+		if (benchmark != NULL)
+		{
+			//	Scripted camera.
+			benchmark->beginFrame();
+			benchmark->moveAlongPath(camera);
+
+			//	Only counting the state changes of recorded frames.
+			if (benchmark->frame == benchmark->warmupFrames)
+			{
+				RenderState::get().resetCounters();
+				terrain->drawnChunks		= 0;
+				terrain->drawnTriangles	= 0;
+				portalA->skippedPasses	= portalB->skippedPasses	= 0;
+				portalA->renderedPasses	= portalB->renderedPasses	= 0;
+				portalA->renderedPixels	= portalB->renderedPixels	= 0;
+				portalA->nestedPasses	= portalB->nestedPasses		= 0;
+			}
+		}
+		else
 		{
-			glfwSetWindowShouldClose(window, true);
+			//	Close window if escape is pressed.
+			if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+			{
+				glfwSetWindowShouldClose(window, true);
+			}
+
+			//	Input.
+			camera->processInput(window);
 		}
 
-		//	Input.
-		camera->processInput(window);
+		renderFrame();
 
-		//	Disabling portals in the buffer.
+		if (benchmark != NULL) benchmark->endFrame();
+
+		//	Swap & Poll.
+		if (window != NULL)
+		{
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
+	}
+
+	//	Write out the benchmark results.
+	if (benchmark != NULL)
+	{
+		RenderState& state = RenderState::get();
+		benchmark->setMetric("stateCallsIssuedPerFrame",	state.issuedCalls / (double)benchmark->frameCount);
+		benchmark->setMetric("stateCallsAvoidedPerFrame",	state.avoidedCalls / (double)benchmark->frameCount);
+		benchmark->setMetric("terrainChunksDrawnPerFrame",	terrain->drawnChunks / (double)benchmark->frameCount);
+		benchmark->setMetric("terrainTrianglesPerFrame",	terrain->drawnTriangles / (double)benchmark->frameCount);
+		benchmark->setMetric("portalPassesPerFrame",		(portalA->renderedPasses + portalB->renderedPasses) / (double)benchmark->frameCount);
+		benchmark->setMetric("portalPixelsPerFrame",		(portalA->renderedPixels + portalB->renderedPixels) / (double)benchmark->frameCount);
+		benchmark->setMetric("portalNestedPassesPerFrame",	(portalA->nestedPasses + portalB->nestedPasses) / (double)benchmark->frameCount);
+
+		if (benchmark->write(reportPath)) std::cout << "Benchmark written to " << reportPath << "." << std::endl;
+		delete benchmark;
+	}
+
+	//	Close the application.
+	glfwTerminate();
+	return 0;
+}
+
+/// <summary>
+/// Renders both portal views, and then the main view. Stencil portals draw their views after the main view instead, into its pixels.
+/// </summary>
+void renderFrame()
+{
+	//	Disabling portals in the buffer.
+	portalA->enabled = false;
+	portalB->enabled = false;
+
+	//	Moving the portal views along, and finding out which of them can be seen from the camera at all.
+	portalA->tick();
+	portalA->updatePortalProjection();
+	portalB->tick();
+	portalB->updatePortalProjection();
+
+	portalA->updateVisibility();
+	portalB->updateVisibility();
+
+	if (!stencilPortals)
+	{
+		//	Drawing to PortalA buffer, only if the portal can show it.
+		beginPass(PASS_PORTAL_A);
+		drawPortalView(portalA, portalBufA);
+		endPass(PASS_PORTAL_A);
+
+		//	Drawing to PortalB buffer.
+		beginPass(PASS_PORTAL_B);
+		drawPortalView(portalB, portalBufB);
+		endPass(PASS_PORTAL_B);
+	}
+	
+	//	Re-enabling portals for main render!
+	portalA->enabled = true;
+	portalB->enabled = true;
+
+	//	Back to main stuff.
+	beginPass(PASS_MAIN);
+	switchToBuffer(mainBuf);
+	drawObjects(camera);
+	endPass(PASS_MAIN);
+
+	if (stencilPortals)
+	{
 		portalA->enabled = false;
 		portalB->enabled = false;
 
-		//	Drawing to PortalA buffer.
-		switchToBuffer(portalBufA);
-		portalA->tick();
-		portalA->updatePortalProjection();
-		drawObjects(portalA->portalProjection);
+		//	Drawing through the pixels PortalA marked.
+		beginPass(PASS_PORTAL_A);
+		drawStencilPortalView(portalA);
+		endPass(PASS_PORTAL_A);
+
+		//	Drawing through PortalB.
+		beginPass(PASS_PORTAL_B);
+		drawStencilPortalView(portalB);
+		endPass(PASS_PORTAL_B);
 
-		//	Drawing to PortalB buffer.
-		switchToBuffer(portalBufB);
-		portalB->tick();
-		portalB->updatePortalProjection();
-		drawObjects(portalB->portalProjection);
-		
-		//	Re-enabling portals for main render!
 		portalA->enabled = true;
 		portalB->enabled = true;
+	}
+}
 
-		//	Back to main stuff.
-		switchToBuffer(0);
-		drawObjects(camera);
+/// <summary>
+/// Renders what can be seen through a portal into its buffer, if the portal is visible. Only the part of the screen the portal
+/// covers is cleared and drawn, and objects are culled against the portal view's narrowed frustum.
+/// Where the portal shows up in its own view, the levels of that are drawn first, deepest first, so every level can show the next.
+/// </summary>
+void drawPortalView(Portal* _portal, unsigned int _buffer)
+{
+	if (!_portal->visible) return;
 
-		//	Swap & Poll.
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+	_portal->enabled = true;
+	RenderState::get().enable(GL_SCISSOR_TEST);
+
+	for (int level = _portal->depth - 1; level > 0; level--)
+	{
+		const PortalView& view = _portal->nestedView(level);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, view.frameBuffer);
+		glViewport(0, 0, view.width, view.height);
+		glScissor(view.scissor.x, view.scissor.y, view.scissor.z, view.scissor.w);
+
+		_portal->viewLevel = level;
+		drawObjects(view.projection);
 	}
 
-	//	Close the application.
-	glfwTerminate();
-	return 0;
+	switchToBuffer(_buffer);
+	glScissor(_portal->scissor.x, _portal->scissor.y, _portal->scissor.z, _portal->scissor.w);
+
+	_portal->viewLevel = 0;
+	drawObjects(_portal->portalProjection);
+
+	_portal->viewLevel	= -1;
+	_portal->enabled	= false;
+	RenderState::get().disable(GL_SCISSOR_TEST);
+
+	//	Next frame's last level shows this one.
+	_portal->cacheView(_buffer);
+}
+
+/// <summary>
+/// Renders what can be seen through a portal straight into the main buffer, only where the portal marked the stencil during
+/// the main view. Call this right after the main view.
+/// </summary>
+void drawStencilPortalView(Portal* _portal)
+{
+	if (!_portal->visible) return;
+
+	//	The sphere's depth is reset as the main camera saw it, the last portal's view may have replaced its FrameData.
+	frameUniforms->upload(camera, skybox->lightDirection);
+	_portal->beginStencilView();
+
+	RenderState::get().enable(GL_SCISSOR_TEST);
+	glScissor(_portal->scissor.x, _portal->scissor.y, _portal->scissor.z, _portal->scissor.w);
+
+	drawObjects(_portal->portalProjection, false);
+
+	RenderState::get().disable(GL_SCISSOR_TEST);
+	_portal->endStencilView();
 }
 
 void switchToBuffer(unsigned int buffer)
@@ -133,17 +424,221 @@ void switchToBuffer(unsigned int buffer)
 /// <summary>
 /// Draws every object in the scene.
 /// </summary>
-void drawObjects(Projection* _projection)
+/// <param name="_clear">Whether to clear the buffer first. Stencil portal views draw over the main view without clearing.</param>
+void drawObjects(Projection* _projection, bool _clear)
 {
 	//	Clearing previous draw.
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (_clear)
+	{
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	}
+
+	//	Uploading the view once for every object in this pass.
+	frameUniforms->upload(_projection, skybox->lightDirection);
 
 	//	Drawing objects.
-	skybox->		draw(_projection->view, _projection->projection, _projection->position);
-	terrain->		draw(_projection->view, _projection->projection, skybox->lightDirection, _projection->position);
-	portalA->		draw(_projection->view, _projection->projection, skybox->lightDirection, _projection->position, portalColorBufA);
-	portalB->		draw(_projection->view, _projection->projection, skybox->lightDirection, _projection->position, portalColorBufB);
+	skybox->		draw(_projection->position);
+	terrain->		draw(_projection);
+
+	//	Objects queued by their draw calls, all in a handful of indirect draws.
+	DrawBatch::get().flush();
+
+	//	Portals go last, so stencil portals only mark the pixels nothing in front of them covers.
+	portalA->		draw(portalColorBufA);
+	portalB->		draw(portalColorBufB);
+}
+
+/// <summary>
+/// Measures the throughput of the terrain's height, normal and raycast queries.
+/// </summary>
+void benchmarkTerrainQueries()
+{
+	const int pointCount	= 1000000;
+	const int rayCount		= 100000;
+
+	//	Random points above the terrain and downward rays from them, generated up front so only the queries are timed.
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	glm::vec2 extent = terrain->extent();
+
+	std::vector<glm::vec3> points(pointCount), directions(rayCount);
+	for (int i = 0; i < pointCount; i++)	points[i]		= glm::vec3(unit(random) * extent.x, 500.0f, unit(random) * extent.y);
+	for (int i = 0; i < rayCount; i++)		directions[i]	= glm::normalize(glm::vec3(unit(random) * 2.0f - 1.0f, -0.1f - unit(random), unit(random) * 2.0f - 1.0f));
+
+	benchmark->measureThroughput("terrainHeightAtPerSecond", pointCount, [&](int i) { return terrain->heightAt(points[i].x, points[i].z); });
+	benchmark->measureThroughput("terrainNormalAtPerSecond", pointCount, [&](int i) { return terrain->normalAt(points[i].x, points[i].z).y; });
+	benchmark->measureThroughput("terrainRaycastPerSecond", rayCount, [&](int i)
+	{
+		float distance = 0;
+		terrain->raycast(points[i], directions[i], 10000.0f, distance);
+		return distance;
+	});
+}
+
+/// <summary>
+/// Measures how long the models take to load through Assimp and through their mesh cache, and, in builds with HEAP_TRACKING,
+/// how much memory the loading worker allocates at most during each (Model::loadPeakBytes: the meshes, not the textures).
+/// The import writes the cache, so the second load always hits it. Each load runs alone, so nothing else adds to its peak.
+/// </summary>
+void benchmarkModelLoads()
+{
+	const char* names[] = { "backpack", "portal" };
+	const char* paths[] = { "models/backpack/backpack.obj", "models/portal/portal.obj" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		Model* imported = new Model(paths[i], false, false);
+		jobs::JobSystem::get().finish();
+
+		Model* cached = new Model(paths[i]);
+		jobs::JobSystem::get().finish();
+
+		TextureStream::get().flush();
+
+		//	Models that aren't there don't get a result.
+		if (imported->loaded && cached->loaded)
+		{
+			benchmark->setMetric(std::string(names[i]) + "ImportMs",		imported->loadMs);
+			benchmark->setMetric(std::string(names[i]) + "CacheLoadMs",	cached->loadMs);
+			benchmark->setMetric(std::string(names[i]) + "CacheHit",		cached->cached);
+
+			//	Without heap tracking there's nothing to report.
+			if (heap::tracking)
+			{
+				benchmark->setMetric(std::string(names[i]) + "ImportPeakBytes",	(double)imported->loadPeakBytes);
+				benchmark->setMetric(std::string(names[i]) + "CachePeakBytes",	(double)cached->loadPeakBytes);
+			}
+		}
+
+		delete imported;
+		delete cached;
+	}
+}
+
+/// <summary>
+/// Draws a grid of portal spheres one by one, as objects draw without the draw batch, and then through the batch.
+/// Measures the CPU time spent submitting each, without waiting on the GPU, and the draw calls. Skipped on contexts without the batch.
+/// </summary>
+void benchmarkBatchedDraws()
+{
+	Model* model = portalA->sphere;
+	if (!DrawBatch::get().supported || !model->loaded) return;
+
+	const int objectCount	= 256;
+	const int repeats		= 20;
+
+	//	A 16 by 16 wall of spheres in front of the camera.
+	glm::mat4 cameraWorld	= glm::inverse(camera->view);
+	glm::vec3 center		= camera->position - glm::vec3(cameraWorld[2]) * 40.0f;
+
+	std::vector<glm::mat4> worlds(objectCount);
+	for (int i = 0; i < objectCount; i++)
+	{
+		glm::vec3 offset	= glm::vec3(cameraWorld[0]) * ((i % 16) - 7.5f) * 3.0f + glm::vec3(cameraWorld[1]) * ((i / 16) - 7.5f) * 3.0f;
+		worlds[i]			= glm::translate(glm::mat4(1.0f), center + offset);
+	}
+
+	//	Never deleted, as the sphere's meshes remember which programs they set up.
+	Shader* shader		= new Shader("shaders/model.vs", "shaders/model.fs");
+	GLint worldLocation	= shader->location("world");
+
+	switchToBuffer(mainBuf);
+	frameUniforms->upload(camera, skybox->lightDirection);
+
+	RenderState& state	= RenderState::get();
+	DrawBatch& batch	= DrawBatch::get();
+
+	//	One by one.
+	glFinish();
+	unsigned long long loopCalls = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		state.useProgram(shader->id);
+		for (const glm::mat4& world : worlds)
+		{
+			glUniformMatrix4fv(worldLocation, 1, GL_FALSE, glm::value_ptr(world));
+			model->Draw(shader->id);
+			loopCalls += model->meshes.size();
+		}
+	}
+	double loopMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+	glFinish();
+
+	//	Batched.
+	unsigned long long batchCalls = batch.issuedCalls;
+	start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (const glm::mat4& world : worlds) batch.add(*model, world);
+		batch.flush();
+	}
+	double batchMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+	glFinish();
+	batchCalls = batch.issuedCalls - batchCalls;
+
+	benchmark->setMetric("loopSubmitMs",		loopMs);
+	benchmark->setMetric("loopDrawCalls",		(double)loopCalls / repeats);
+	benchmark->setMetric("batchedSubmitMs",		batchMs);
+	benchmark->setMetric("batchedDrawCalls",	(double)batchCalls / repeats);
+}
+
+/// <summary>
+/// Scatters thousands of spheres over the terrain as one instanced object, and measures the CPU time of drawing them
+/// from the camera, culling included, and how many survive the culling.
+/// </summary>
+void benchmarkInstancedDraws()
+{
+	const int instanceCount	= 4096;
+	const int repeats		= 20;
+
+	InstancedObject* scattered = new InstancedObject("models/portal/portal.obj");
+	jobs::JobSystem::get().finish();
+	if (!scattered->model->loaded)
+	{
+		delete scattered;
+		return;
+	}
+
+	std::mt19937 random(4321);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	glm::vec2 extent = terrain->extent();
+
+	for (int i = 0; i < instanceCount; i++)
+	{
+		float x = unit(random) * extent.x, z = unit(random) * extent.y;
+
+		glm::mat4 world = glm::translate(glm::mat4(1.0f), glm::vec3(x, terrain->heightAt(x, z), z));
+		world = world * glm::toMat4(glm::quat(glm::vec3(0.0f, unit(random) * 6.2831853f, 0.0f)));
+		world = glm::scale(world, glm::vec3(2.0f + unit(random) * 4.0f));
+
+		scattered->add(world);
+	}
+
+	switchToBuffer(mainBuf);
+	frameUniforms->upload(camera, skybox->lightDirection);
+	glFinish();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repeats; r++) scattered->draw(camera);
+	double instancedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+	glFinish();
+
+	benchmark->setMetric("instancedSubmitMs",	instancedMs);
+	benchmark->setMetric("instancedVisible",	scattered->visibleInstances);
+
+	delete scattered;
+}
+
+void beginPass(int _pass)
+{
+	if (benchmark != NULL) benchmark->beginPass(_pass);
+}
+
+void endPass(int _pass)
+{
+	if (benchmark != NULL) benchmark->endPass(_pass);
 }
 
 /// <summary>
@@ -162,6 +657,7 @@ int init(GLFWwindow*& window)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_STENCIL_BITS, 8);
 
 	//	Create a GLFW window.
 	window = glfwCreateWindow(width, height, "Graphics Program", NULL, NULL);
@@ -185,9 +681,123 @@ int init(GLFWwindow*& window)
 		return -1;
 	}
 
+	DrawBatch::get().load((GLADloadproc)glfwGetProcAddress);
+
 	return 0;
 }
 
+/// <summary>
+/// Initializes an offscreen context for headless benchmarking, without a visible window.
+/// Builds with HEADLESS_EGL use a surfaceless EGL context, which also works without a display.
+/// </summary>
+/// <param name="window">Reference to the hidden window, stays NULL for EGL.</param>
+/// <returns>Callback integer stating the result of initialization.</returns>
+int initHeadless(GLFWwindow*& window)
+{
+#ifdef HEADLESS_EGL
+	//	Initialize EGL, preferring the surfaceless platform since there might not be a display at all.
+	EGLDisplay display = EGL_NO_DISPLAY;
+
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+	{
+		std::cout << "ERROR: EGL initialization failed." << std::endl;
+		return -1;
+	}
+
+	//	Pick a config that can render OpenGL. Surfaceless displays may have none, which is fine without a surface.
+	const EGLint configAttributes[] =
+	{
+		EGL_RENDERABLE_TYPE,	EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+	{
+		config = EGL_NO_CONFIG_KHR;
+	}
+
+	//	Create a 3.3 core context without any surface.
+	const EGLint contextAttributes[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION,			3,
+		EGL_CONTEXT_MINOR_VERSION,			3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK,	EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	eglBindAPI(EGL_OPENGL_API);
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		std::cout << "ERROR: Failed to create surfaceless EGL context." << std::endl;
+		return -1;
+	}
+
+	//	Load GLAD.
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+	{
+		std::cout << "ERROR: Failed to load Glad." << std::endl;
+		return -1;
+	}
+
+	DrawBatch::get().load((GLADloadproc)eglGetProcAddress);
+
+	return 0;
+#else
+	//	Fall back on a regular context that is never shown.
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	return init(window);
+#endif
+}
+
+/// <summary>
+/// Reads the command line.
+/// --benchmark [frames]	Renders a scripted camera path and writes a timing report.
+/// --headless [frames]		Same as --benchmark, but without a visible window. Runs without a display in builds with HEADLESS_EGL.
+/// --warmup [frames]		Frames rendered before recording starts. (Default: 10)
+/// --output [path]			Where to write the report to. (Default: benchmark.json)
+/// --portals [mode]		How portal views are rendered: "buffers" into offscreen buffers, or "stencil" straight into the main view. (Default: buffers)
+/// --portal-depth [levels]	Levels of views rendered for portals seen through themselves, counting their own view, in buffer mode. (Default: 3)
+/// </summary>
+void parseArguments(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+
+		if (strcmp(argv[i], "--benchmark") == 0 || strcmp(argv[i], "--headless") == 0)
+		{
+			headless		= headless || strcmp(argv[i], "--headless") == 0;
+			benchmarkFrames	= 600;
+
+			if (hasValue && atoi(argv[i + 1]) > 0) benchmarkFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+		{
+			warmupFrames = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--output") == 0 && hasValue)
+		{
+			reportPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--portals") == 0 && hasValue)
+		{
+			stencilPortals = strcmp(argv[++i], "stencil") == 0;
+		}
+		else if (strcmp(argv[i], "--portal-depth") == 0 && hasValue)
+		{
+			portalDepth = std::max(atoi(argv[++i]), 1);
+		}
+	}
+}
+
 /// <summary>
 /// GLFW mouse callback to handle input.
 /// </summary>
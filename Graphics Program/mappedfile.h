@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/// <summary>
+/// A file mapped read only into memory, so its contents can be used in place instead of being read into a buffer first.
+/// Pages are only loaded when they are touched, and stay shared with the OS' file cache.
+/// </summary>
+class MappedFile
+{
+public:
+	MappedFile(const std::string& _path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) return;
+
+		bytes	= (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		length	= bytes != NULL ? (size_t)fileSize.QuadPart : 0;
+#else
+		file = open(_path.c_str(), O_RDONLY);
+		if (file < 0) return;
+
+		struct stat status;
+		if (fstat(file, &status) != 0 || status.st_size == 0) return;
+
+		void* address = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (address == MAP_FAILED) return;
+
+		bytes	= (const unsigned char*)address;
+		length	= (size_t)status.st_size;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (bytes != NULL)					UnmapViewOfFile(bytes);
+		if (mapping != NULL)				CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)	CloseHandle(file);
+#else
+		if (bytes != NULL)	munmap((void*)bytes, length);
+		if (file >= 0)		close(file);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/// <summary>
+	/// Returns the contents of the file, or NULL if it couldn't be mapped.
+	/// </summary>
+	const unsigned char* data() const
+	{
+		return bytes;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE file		= INVALID_HANDLE_VALUE;
+	HANDLE mapping	= NULL;
+#else
+	int file = -1;
+#endif
+
+	const unsigned char* bytes	= NULL;
+	size_t length				= 0;
+};
@@ -3,15 +3,31 @@
 
 #include <glad/glad.h> // holds all OpenGL type declarations
 
+#include "renderstate.h"
+#include "mappedfile.h"
+#include "vertexformat.h"
+#include "geometrypool.h"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <iostream>
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
 
+// texture types in sampler unit order, a mesh's N-th texture of a type is bound to unit (N - 1) * TEXTURE_TYPE_COUNT + type index.
+// this keeps units the same for every mesh, so a program's samplers only ever need to be set once.
+#define TEXTURE_TYPE_COUNT 6
+#define MAX_TEXTURES_PER_TYPE 2
+static const char* const textureTypes[TEXTURE_TYPE_COUNT] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_roughness", "texture_ao", "texture_height" };
+
+// the full vertex, as it comes out of the importer and is stored in the mesh cache.
+// the GL buffers only get the attributes a shader reads, packed, see Mesh::pack.
 struct Vertex {
     // position
     glm::vec3 Position;
@@ -35,116 +51,312 @@ struct Texture {
     string path;
 };
 
+// a texture resolved to the unit and sampler it is bound to.
+struct TextureBinding {
+    unsigned int id;
+    unsigned int unit;
+    string sampler;
+};
+
 class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    unsigned int vertexCount, indexCount;
+    unsigned int attributes;    // the VERTEX_* attributes the source data has, the others are left zeroed in the vertices.
+    VertexLayout layout;        // how the vertices are laid out in the GL buffer.
+    glm::vec3 boundsMin, boundsMax; // bounding box of the positions.
+    GeometryAllocation geometry;    // where the vertices and indices live in the geometry pool, once uploaded.
+
+    // constructor, only keeps the data so it can run on any thread. upload() creates the GL objects.
+    // pass the vectors with std::move to hand them over without copying.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, unsigned int attributes = VERTEX_ALL_ATTRIBUTES)
+    {
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        this->vertexCount = static_cast<unsigned int>(this->vertices.size());
+        this->indexCount = static_cast<unsigned int>(this->indices.size());
+        this->attributes = attributes;
+        this->layout = fullLayout();
+        calculateBounds(this->vertices.data());
+    }
+
+    // constructor for a mesh whose data lives in a mapped mesh cache. upload() reads straight from the mapping,
+    // which is kept open until then, so the vertices never get copied into the vectors.
+    Mesh(shared_ptr<MappedFile> mapping, const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, vector<Texture> textures, unsigned int attributes = VERTEX_ALL_ATTRIBUTES)
+    {
+        this->mapping = mapping;
+        this->mappedVertices = vertices;
+        this->mappedIndices = indices;
+        this->vertexCount = vertexCount;
+        this->indexCount = indexCount;
+        this->textures = std::move(textures);
+        this->attributes = attributes;
+        this->layout = fullLayout();
+        calculateBounds(vertices);
+    }
 
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // the layout of the full Vertex, every attribute as floats. 88 bytes per vertex.
+    static VertexLayout fullLayout()
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        VertexLayout full;
+        full.add(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3));
+        full.add(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3));
+        full.add(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2));
+        full.add(3, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3));
+        full.add(4, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3));
+        full.add(5, 4, GL_INT, GL_FALSE, sizeof(int) * MAX_BONE_INFLUENCE, true);
+        full.add(6, 4, GL_FLOAT, GL_FALSE, sizeof(float) * MAX_BONE_INFLUENCE);
+        return full;
+    }
+
+    // picks the smallest layout that holds the attributes the shader reads (see Shader::attributes) and this mesh has,
+    // and packs the vertices into it: directions as 10:10:10:2 SNORM, texture coordinates as 16 bit UNORM when they
+    // stay inside [0, 1], and positions as half floats if the packing asks for it. only does CPU work, so it can run on any thread.
+    // skinned meshes keep the full layout.
+    void pack(unsigned int shaderAttributes, unsigned int packing = VERTEX_PACK_NONE)
+    {
+        const Vertex* source = mapping ? mappedVertices : vertices.data();
+        unsigned int used = (shaderAttributes & attributes) | VERTEX_POSITION;
+
+        if (used & VERTEX_BONES)
+        {
+            layout = fullLayout();
+            return;
+        }
+
+        bool halfPosition = (packing & VERTEX_PACK_HALF_POSITION) != 0;
+        bool unormTexCoords = true;
+        for (unsigned int i = 0; i < vertexCount && unormTexCoords; i++)
+            unormTexCoords = source[i].TexCoords.x >= 0.0f && source[i].TexCoords.x <= 1.0f && source[i].TexCoords.y >= 0.0f && source[i].TexCoords.y <= 1.0f;
+
+        // every attribute ends on a multiple of 4 bytes, half positions are padded to 4 components
+        layout = VertexLayout();
+        if (halfPosition)                   layout.add(0, 3, GL_HALF_FLOAT, GL_FALSE, 4 * sizeof(uint16_t));
+        else                                layout.add(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3));
+        if (used & VERTEX_NORMAL)           layout.add(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(uint32_t));
+        if (used & VERTEX_TEXCOORDS)
+        {
+            if (unormTexCoords)             layout.add(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, 2 * sizeof(uint16_t));
+            else                            layout.add(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2));
+        }
+        if (used & VERTEX_TANGENT)          layout.add(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(uint32_t));
+        if (used & VERTEX_BITANGENT)        layout.add(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(uint32_t));
+
+        packedVertices.resize((size_t)vertexCount * layout.stride);
+        unsigned char* output = packedVertices.data();
+        for (unsigned int i = 0; i < vertexCount; i++)
+        {
+            const Vertex& vertex = source[i];
+            if (halfPosition)
+            {
+                uint16_t position[4] = { vertexformat::toHalf(vertex.Position.x), vertexformat::toHalf(vertex.Position.y), vertexformat::toHalf(vertex.Position.z), vertexformat::toHalf(1.0f) };
+                output = write(output, position, sizeof(position));
+            }
+            else
+                output = write(output, &vertex.Position, sizeof(glm::vec3));
+
+            uint32_t normal = vertexformat::toSnorm10(vertex.Normal), tangent = vertexformat::toSnorm10(vertex.Tangent), bitangent = vertexformat::toSnorm10(vertex.Bitangent);
+            if (used & VERTEX_NORMAL)
+                output = write(output, &normal, sizeof(normal));
+            if ((used & VERTEX_TEXCOORDS) && unormTexCoords)
+            {
+                uint16_t texCoords[2] = { (uint16_t)std::round(vertex.TexCoords.x * 65535.0f), (uint16_t)std::round(vertex.TexCoords.y * 65535.0f) };
+                output = write(output, texCoords, sizeof(texCoords));
+            }
+            else if (used & VERTEX_TEXCOORDS)
+                output = write(output, &vertex.TexCoords, sizeof(glm::vec2));
+            if (used & VERTEX_TANGENT)
+                output = write(output, &tangent, sizeof(tangent));
+            if (used & VERTEX_BITANGENT)
+                output = write(output, &bitangent, sizeof(bitangent));
+        }
+    }
+
+    // copies the vertices and indices into the geometry pool, and resolves the texture units. has to run on the GL thread.
+    // the GL buffers hold their own copy afterwards, so the vertices, indices and textures are freed,
+    // unless keepCpuData asks to keep them around, e.g. for collision or picking.
+    void upload(bool keepCpuData = false)
+    {
+        // the mapping is closed by the upload, so kept data has to be copied out of it first
+        if (keepCpuData && mapping)
+        {
+            vertices.assign(mappedVertices, mappedVertices + vertexCount);
+            indices.assign(mappedIndices, mappedIndices + indexCount);
+        }
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
+        resolveBindings();
+
+        if (!keepCpuData)
+        {
+            vector<Vertex>().swap(vertices);
+            vector<unsigned int>().swap(indices);
+            vector<Texture>().swap(textures);
+        }
+    }
+
+    // bytes of mesh data held in memory on the CPU side.
+    size_t cpuBytes() const
+    {
+        return vertices.capacity() * sizeof(Vertex) + packedVertices.capacity() + indices.capacity() * sizeof(unsigned int) + textures.capacity() * sizeof(Texture);
+    }
+
+    // bytes of mesh data held in GL buffers, zero until uploaded.
+    size_t gpuBytes() const
+    {
+        return uploaded ? (size_t)vertexCount * layout.stride + indexCount * sizeof(unsigned int) : 0;
+    }
+
+    // gives the mesh's space in the geometry pool back.
+    void release()
+    {
+        GeometryPool::get().free(geometry);
+        geometry = GeometryAllocation();
     }
 
     // render the mesh
     void Draw(unsigned int program)
     {
-        // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
-        unsigned int roughnessNr = 1;
-        unsigned int ambientOcclusionNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
+        bindTextures(program);
+
+        // draw mesh. meshes of the same layout share the vertex array, so only the first of them binds it
+        RenderState::get().bindVertexArray(geometry.vertexArray);
+        glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, geometry.indexOffset(), geometry.baseVertex);
+    }
+
+    // render the mesh instanceCount times. expects the per-instance attributes to be set up on the mesh's vertex array.
+    void DrawInstanced(unsigned int program, unsigned int instanceCount)
+    {
+        bindTextures(program);
+
+        RenderState::get().bindVertexArray(geometry.vertexArray);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, geometry.indexOffset(), instanceCount, geometry.baseVertex);
+    }
+
+    // binds the mesh's textures for a draw with the program, which has to be in use.
+    void bindTextures(unsigned int program)
+    {
+        // point the program's samplers at our units, only the first time we are drawn with it
+        if (std::find(configuredPrograms.begin(), configuredPrograms.end(), program) == configuredPrograms.end())
+            configureProgram(program);
+
+        // bind appropriate textures, the state cache skips the ones that are already bound
+        RenderState& state = RenderState::get();
+        for (unsigned int i = 0; i < bindings.size(); i++)
+            state.bindTexture(bindings[i].unit, bindings[i].id);
+    }
+
+    // whether two meshes bind the same textures to the same units, so they can be drawn in one batch.
+    bool sameTextures(const Mesh& other) const
+    {
+        if (bindings.size() != other.bindings.size())
+            return false;
+
+        for (unsigned int i = 0; i < bindings.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-            else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-            else if (name == "texture_roughness")
-                number = std::to_string(roughnessNr++); // transfer unsigned int to string
-            else if (name == "texture_ao")
-                number = std::to_string(ambientOcclusionNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(program, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            if (bindings[i].id != other.bindings[i].id || bindings[i].unit != other.bindings[i].unit)
+                return false;
         }
+        return true;
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    // orders meshes by their textures, so meshes that share them end up next to each other.
+    bool texturesBefore(const Mesh& other) const
+    {
+        if (bindings.size() != other.bindings.size())
+            return bindings.size() < other.bindings.size();
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        for (unsigned int i = 0; i < bindings.size(); i++)
+        {
+            if (bindings[i].id != other.bindings[i].id)
+                return bindings[i].id < other.bindings[i].id;
+            if (bindings[i].unit != other.bindings[i].unit)
+                return bindings[i].unit < other.bindings[i].unit;
+        }
+        return false;
     }
 
 private:
     // render data 
-    unsigned int VBO, EBO;
+    bool uploaded = false;
+    shared_ptr<MappedFile> mapping;
+    const Vertex*       mappedVertices = nullptr;
+    const unsigned int* mappedIndices = nullptr;
+    vector<unsigned char> packedVertices;   // the vertices in the packed layout, until they are uploaded.
+    vector<TextureBinding> bindings;
+    vector<unsigned int>   configuredPrograms;
 
-    // initializes all the buffer objects/arrays
+    // assigns every texture its unit and sampler name (the N in texture_diffuseN), once at load.
+    void resolveBindings()
+    {
+        unsigned int count[TEXTURE_TYPE_COUNT] = { 0 };
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            unsigned int type = 0;
+            while (type < TEXTURE_TYPE_COUNT && textures[i].type != textureTypes[type])
+                type++;
+
+            if (type == TEXTURE_TYPE_COUNT || count[type] == MAX_TEXTURES_PER_TYPE)
+            {
+                cout << "WARNING::MESH:: Skipping texture " << textures[i].path << " of type " << textures[i].type << endl;
+                continue;
+            }
+
+            TextureBinding binding;
+            binding.id = textures[i].id;
+            binding.unit = count[type] * TEXTURE_TYPE_COUNT + type;
+            binding.sampler = textures[i].type + std::to_string(++count[type]);
+            bindings.push_back(binding);
+        }
+    }
+
+    // sets the sampler uniforms of a program we haven't been drawn with before. expects the program to be in use.
+    void configureProgram(unsigned int program)
+    {
+        for (unsigned int i = 0; i < bindings.size(); i++)
+            glUniform1i(glGetUniformLocation(program, bindings[i].sampler.c_str()), bindings[i].unit);
+
+        configuredPrograms.push_back(program);
+    }
+
+    // fits the bounding box around the positions.
+    void calculateBounds(const Vertex* source)
+    {
+        boundsMin = boundsMax = vertexCount > 0 ? source[0].Position : glm::vec3(0.0f);
+        for (unsigned int i = 1; i < vertexCount; i++)
+        {
+            boundsMin = glm::min(boundsMin, source[i].Position);
+            boundsMax = glm::max(boundsMax, source[i].Position);
+        }
+    }
+
+    // copies an attribute into the packed vertex, returns where the next one goes.
+    static unsigned char* write(unsigned char* output, const void* data, size_t size)
+    {
+        memcpy(output, data, size);
+        return output + size;
+    }
+
+    // sub allocates the mesh from the geometry pool of its layout
     void setupMesh()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-        // ids
-        glEnableVertexAttribArray(5);
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-        // weights
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+        // packed meshes upload their packed copy. the others upload the full vertices, meshes from the mesh cache
+        // straight from the mapped file. a struct's memory layout is sequential for all its items, so it translates to a byte array.
+        const void* vertexData = !packedVertices.empty() ? (const void*)packedVertices.data() : (mapping ? (const void*)mappedVertices : (const void*)vertices.data());
+        const unsigned int* indexData = mapping ? mappedIndices : indices.data();
+
+        geometry = GeometryPool::get().allocate(layout, vertexData, vertexCount, indexData, indexCount);
+
+        // the buffers have their own copy now, the file can be unmapped once no other mesh uses it.
+        uploaded = true;
+        vector<unsigned char>().swap(packedVertices);
+        mapping.reset();
+        mappedVertices = nullptr;
+        mappedIndices = nullptr;
     }
 };
 #endif
\ No newline at end of file
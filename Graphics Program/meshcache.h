@@ -0,0 +1,254 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <functional>
+
+#include "mesh.h"
+#include "sourcestamp.h"
+#include "mappedfile.h"	//	Also brings in windows.h, for MoveFileExA.
+
+//	Bump this whenever the layout of the file, or of Vertex, changes.
+#define MESH_CACHE_VERSION 2
+
+//	Vertex and index blocks start at multiples of this, so they can be used in place.
+#define MESH_CACHE_ALIGNMENT 16
+
+/// <summary>
+/// Binary cache of a model's imported meshes, so later loads can skip Assimp. The file is mapped, and the meshes
+/// point straight into it. It holds the vertices and indices as they come out of the importer's post processing,
+/// and the textures every mesh uses.
+/// </summary>
+namespace meshcache
+{
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t vertexSize;
+		uint32_t meshCount;
+		uint32_t textureCount;
+		uint32_t padding;
+
+		//	Size and modification time of the source file the cache was built from.
+		uint64_t sourceSize;
+		int64_t sourceTime;
+	};
+
+	//	Offsets are from the start of the file.
+	struct Entry
+	{
+		uint32_t vertexCount, indexCount, textureCount, attributes;
+		uint64_t vertexOffset, indexOffset, textureOffset;
+	};
+
+	/// <summary>
+	/// Where the cache of a model lives: next to it, with the extension swapped for .mesh.
+	/// </summary>
+	inline std::string cachePath(const std::string& _source)
+	{
+		size_t dot		= _source.find_last_of('.');
+		size_t slash	= _source.find_last_of("/\\");
+
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return _source + ".mesh";
+		return _source.substr(0, dot) + ".mesh";
+	}
+
+	/// <summary>
+	/// Moves a file over another one, replacing it in one step, so readers see either the old or the new file.
+	/// </summary>
+	inline bool replaceFile(const std::string& _from, const std::string& _to)
+	{
+#ifdef _WIN32
+		return MoveFileExA(_from.c_str(), _to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(_from.c_str(), _to.c_str()) == 0;
+#endif
+	}
+
+	/// <summary>
+	/// Writes the meshes of a model to its cache. The file is written next to the cache first, and then moved over it,
+	/// as models sharing a source may be imported on several workers at once, and others may be reading the cache meanwhile.
+	/// </summary>
+	/// <param name="_textures">Every texture the model uses, the meshes' textures are stored as indices into it.</param>
+	/// <returns>Whether the file could be written.</returns>
+	inline bool write(const std::string& _source, const std::vector<Mesh>& _meshes, const std::vector<Texture>& _textures)
+	{
+		Header header = {};
+		memcpy(header.magic, "MESH", 4);
+		header.version		= MESH_CACHE_VERSION;
+		header.vertexSize	= sizeof(Vertex);
+		header.meshCount	= (uint32_t)_meshes.size();
+		header.textureCount	= (uint32_t)_textures.size();
+		sourcestamp::get(_source, header.sourceSize, header.sourceTime);
+
+		//	Texture table, as the length prefixed type and path of every texture.
+		std::vector<char> table;
+		auto addString = [&table](const std::string& _string)
+		{
+			uint32_t length = (uint32_t)_string.size();
+			table.insert(table.end(), (const char*)&length, (const char*)&length + sizeof(length));
+			table.insert(table.end(), _string.begin(), _string.end());
+		};
+
+		for (const Texture& texture : _textures)
+		{
+			addString(texture.type);
+			addString(texture.path);
+		}
+
+		//	Laying out the blocks behind the header, the entries and the table.
+		std::vector<Entry> entries(_meshes.size());
+		std::vector<std::vector<uint32_t>> textureIndices(_meshes.size());
+
+		uint64_t offset = sizeof(Header) + entries.size() * sizeof(Entry) + table.size();
+		for (size_t i = 0; i < _meshes.size(); i++)
+		{
+			for (const Texture& texture : _meshes[i].textures)
+			{
+				for (uint32_t j = 0; j < _textures.size(); j++)
+				{
+					if (_textures[j].path != texture.path) continue;
+
+					textureIndices[i].push_back(j);
+					break;
+				}
+			}
+
+			entries[i].textureCount		= (uint32_t)textureIndices[i].size();
+			entries[i].textureOffset	= offset;
+			offset += textureIndices[i].size() * sizeof(uint32_t);
+		}
+
+		for (size_t i = 0; i < _meshes.size(); i++)
+		{
+			offset = (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+
+			entries[i].attributes	= _meshes[i].attributes;
+			entries[i].vertexCount	= (uint32_t)_meshes[i].vertices.size();
+			entries[i].vertexOffset	= offset;
+			offset += _meshes[i].vertices.size() * sizeof(Vertex);
+
+			offset = (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+
+			entries[i].indexCount	= (uint32_t)_meshes[i].indices.size();
+			entries[i].indexOffset	= offset;
+			offset += _meshes[i].indices.size() * sizeof(unsigned int);
+		}
+
+		//	Named after the thread, so concurrent writers don't share it.
+		std::string path		= cachePath(_source);
+		std::string temporary	= path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+		std::ofstream file(temporary, std::ios::binary);
+		if (!file.is_open()) return false;
+
+		file.write((const char*)&header, sizeof(Header));
+		file.write((const char*)entries.data(), entries.size() * sizeof(Entry));
+		file.write(table.data(), table.size());
+		for (const std::vector<uint32_t>& indices : textureIndices) file.write((const char*)indices.data(), indices.size() * sizeof(uint32_t));
+
+		const char padding[MESH_CACHE_ALIGNMENT] = {};
+		for (size_t i = 0; i < _meshes.size(); i++)
+		{
+			file.write(padding, entries[i].vertexOffset - (uint64_t)file.tellp());
+			file.write((const char*)_meshes[i].vertices.data(), _meshes[i].vertices.size() * sizeof(Vertex));
+
+			file.write(padding, entries[i].indexOffset - (uint64_t)file.tellp());
+			file.write((const char*)_meshes[i].indices.data(), _meshes[i].indices.size() * sizeof(unsigned int));
+		}
+
+		file.close();
+
+		//	Failing to replace is fine too, e.g. when a mapped cache can't be replaced on Windows. The next load tries again.
+		if (!file || !replaceFile(temporary, path))
+		{
+			std::remove(temporary.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Maps the cache of a model, and creates its meshes pointing into the mapping. Only does CPU work, so it can run on a worker thread.
+	/// </summary>
+	/// <returns>False if there is no cache, or it is out of date, in which case the model should be imported.</returns>
+	inline bool read(const std::string& _source, std::vector<Mesh>& _meshes, std::vector<Texture>& _textures)
+	{
+		std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>(cachePath(_source));
+
+		const unsigned char* data	= mapping->data();
+		size_t size					= mapping->size();
+		if (data == NULL || size < sizeof(Header)) return false;
+
+		Header header;
+		memcpy(&header, data, sizeof(Header));
+
+		bool stale = !sourcestamp::current(_source, header.sourceSize, header.sourceTime);
+		if (memcmp(header.magic, "MESH", 4) != 0 || header.version != MESH_CACHE_VERSION || header.vertexSize != sizeof(Vertex) || stale) return false;
+
+		auto fits = [size](uint64_t _offset, uint64_t _bytes) { return _offset <= size && _bytes <= size - _offset; };
+
+		uint64_t offset = sizeof(Header);
+		if (!fits(offset, (uint64_t)header.meshCount * sizeof(Entry))) return false;
+
+		std::vector<Entry> entries(header.meshCount);
+		memcpy(entries.data(), data + offset, entries.size() * sizeof(Entry));
+		offset += entries.size() * sizeof(Entry);
+
+		auto readString = [&](std::string& _string)
+		{
+			uint32_t length;
+			if (!fits(offset, sizeof(length))) return false;
+			memcpy(&length, data + offset, sizeof(length));
+			offset += sizeof(length);
+
+			if (!fits(offset, length)) return false;
+			_string.assign((const char*)data + offset, length);
+			offset += length;
+			return true;
+		};
+
+		if (!fits(offset, (uint64_t)header.textureCount * 2 * sizeof(uint32_t))) return false;
+
+		std::vector<Texture> textures(header.textureCount);
+		for (Texture& texture : textures)
+		{
+			texture.id = 0;
+			if (!readString(texture.type) || !readString(texture.path)) return false;
+		}
+
+		std::vector<Mesh> meshes;
+		meshes.reserve(entries.size());
+		for (const Entry& entry : entries)
+		{
+			if (!fits(entry.textureOffset, (uint64_t)entry.textureCount * sizeof(uint32_t))
+				|| !fits(entry.vertexOffset, (uint64_t)entry.vertexCount * sizeof(Vertex))
+				|| !fits(entry.indexOffset, (uint64_t)entry.indexCount * sizeof(unsigned int))
+				|| entry.vertexOffset % MESH_CACHE_ALIGNMENT != 0 || entry.indexOffset % MESH_CACHE_ALIGNMENT != 0) return false;
+
+			std::vector<Texture> meshTextures;
+			for (uint32_t i = 0; i < entry.textureCount; i++)
+			{
+				uint32_t index;
+				memcpy(&index, data + entry.textureOffset + i * sizeof(uint32_t), sizeof(index));
+
+				if (index >= textures.size()) return false;
+				meshTextures.push_back(textures[index]);
+			}
+
+			meshes.push_back(Mesh(mapping, (const Vertex*)(data + entry.vertexOffset), entry.vertexCount, (const unsigned int*)(data + entry.indexOffset), entry.indexCount, std::move(meshTextures), entry.attributes));
+		}
+
+		_meshes		= std::move(meshes);
+		_textures	= std::move(textures);
+		return true;
+	}
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+namespace mipmap
+{
+	/// <summary>
+	/// Halves an image with a box filter, to build the next level of a mip chain. Odd sizes are clamped, so the last row and column are counted twice.
+	/// </summary>
+	/// <param name="_halfWidth">Set to the width of the result.</param>
+	/// <param name="_halfHeight">Set to the height of the result.</param>
+	inline std::vector<unsigned char> downsample(const unsigned char* _source, int _width, int _height, int _channels, int& _halfWidth, int& _halfHeight)
+	{
+		_halfWidth	= std::max(_width / 2, 1);
+		_halfHeight	= std::max(_height / 2, 1);
+
+		std::vector<unsigned char> level((size_t)_halfWidth * _halfHeight * _channels);
+
+		for (int y = 0; y < _halfHeight; y++)
+		{
+			const unsigned char* row0 = _source + (size_t)std::min(y * 2, _height - 1) * _width * _channels;
+			const unsigned char* row1 = _source + (size_t)std::min(y * 2 + 1, _height - 1) * _width * _channels;
+
+			for (int x = 0; x < _halfWidth; x++)
+			{
+				int x0 = std::min(x * 2, _width - 1) * _channels, x1 = std::min(x * 2 + 1, _width - 1) * _channels;
+
+				for (int c = 0; c < _channels; c++)
+				{
+					level[((size_t)y * _halfWidth + x) * _channels + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+				}
+			}
+		}
+
+		return level;
+	}
+};
@@ -11,6 +11,10 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "meshcache.h"
+#include "jobs.h"
+#include "texturestream.h"
+#include "heap.h"
 
 #include <string>
 #include <fstream>
@@ -18,6 +22,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <chrono>
 using namespace std;
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
@@ -30,24 +35,132 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    bool loaded = false;    // set on the main thread once the meshes are uploaded, until then the model draws nothing.
+    bool cached = false;    // whether the meshes came from the mesh cache instead of Assimp.
+    double loadMs = 0;      // time the worker spent loading the meshes, in milliseconds.
+    size_t loadPeakBytes = 0;   // most heap bytes the worker had allocated at once while loading the meshes, textures come later and aren't in it.
+                                // only counted with HEAP_TRACKING, only counts operator new in this module (not inside the Assimp DLL on MSVC),
+                                // and the peak is process wide, so it's only meaningful when nothing else loads at the same time.
+    bool keepCpuData;       // whether the meshes keep their vertices and indices in memory after the upload.
+    unsigned int attributes;    // the VERTEX_* attributes the shader reads, the meshes only upload those.
+    unsigned int packing;       // extra VERTEX_PACK_* options for the meshes.
 
-    // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. the import runs on a worker thread, so this returns right away.
+    // the meshes come from the model's mesh cache when it is up to date, otherwise they are imported and the cache is rebuilt.
+    // once uploaded the meshes only live on the GPU, pass keepCpuData for models whose vertices are needed later, e.g. for collision.
+    // pass the attributes of the shader the model is drawn with (Shader::attributes), so the vertices are packed down to just those.
+    Model(string const& path, bool gamma = false, bool useCache = true, bool keepCpuData = false, unsigned int attributes = VERTEX_ALL_ATTRIBUTES, unsigned int packing = VERTEX_PACK_NONE)
+        : gammaCorrection(gamma), keepCpuData(keepCpuData), attributes(attributes), packing(packing)
     {
-        loadModel(path);
+        jobs::async([this, path, useCache]()
+        {
+            size_t heapBaseline = heap::current();
+            if (heap::tracking) heap::resetPeak();
+
+            auto loadStart = std::chrono::high_resolution_clock::now();
+            bool succeeded = loadModel(path, useCache);
+            loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadStart).count();
+            loadPeakBytes = heap::peak() - heapBaseline;
+
+            if (succeeded)
+                jobs::onMainThread([this]() { upload(); });
+        });
+    }
+
+    // deletes the GL objects of the model. only delete a model once it's done loading, and its textures are done streaming.
+    ~Model()
+    {
+        if (!loaded)
+            return;
+
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].release();
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            RenderState::get().deleteTexture(textures_loaded[i].id);
+    }
+
+    // bytes of mesh data held on the CPU side, summed over the meshes. see Mesh::cpuBytes for a single mesh.
+    size_t cpuBytes() const
+    {
+        size_t bytes = 0;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            bytes += meshes[i].cpuBytes();
+        return bytes;
+    }
+
+    // bytes of mesh data held in GL buffers, summed over the meshes. see Mesh::gpuBytes for a single mesh.
+    size_t gpuBytes() const
+    {
+        size_t bytes = 0;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            bytes += meshes[i].gpuBytes();
+        return bytes;
+    }
+
+    // bounding sphere around the meshes, in model space. only valid once loaded.
+    void boundingSphere(glm::vec3& center, float& radius) const
+    {
+        glm::vec3 boundsMin(0.0f), boundsMax(0.0f);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            boundsMin = i == 0 ? meshes[i].boundsMin : glm::min(boundsMin, meshes[i].boundsMin);
+            boundsMax = i == 0 ? meshes[i].boundsMax : glm::max(boundsMax, meshes[i].boundsMax);
+        }
+
+        center = (boundsMin + boundsMax) * 0.5f;
+        radius = glm::length(boundsMax - boundsMin) * 0.5f;
     }
 
     // draws the model, and thus all its meshes
     void Draw(unsigned int shader)
     {
+        if (!loaded)
+            return;
+
         for (unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
 
 private:
+    // loads the textures and creates the GL objects of the imported meshes. runs on the main thread.
+    void upload()
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            textures_loaded[i].id = TextureFromFile(textures_loaded[i].path.c_str(), this->directory);
+
+        // the meshes got copies of the textures while importing, point them at the ids
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+            {
+                for (unsigned int k = 0; k < textures_loaded.size(); k++)
+                {
+                    if (meshes[i].textures[j].path == textures_loaded[k].path)
+                        meshes[i].textures[j].id = textures_loaded[k].id;
+                }
+            }
+
+            meshes[i].upload(keepCpuData);
+        }
+
+        loaded = true;
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const& path)
+    // runs on a worker thread, so it can't touch GL.
+    bool loadModel(string const& path, bool useCache)
     {
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // the cache is mapped, and the meshes are uploaded straight from it
+        if (useCache && meshcache::read(path, meshes, textures_loaded))
+        {
+            cached = true;
+            packMeshes();
+            return true;
+        }
+
         // read file via ASSIMP
         Assimp::Importer importer;
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
@@ -55,13 +168,24 @@ private:
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return false;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
         // process ASSIMP's root node recursively
+        meshes.reserve(scene->mNumMeshes);
         processNode(scene->mRootNode, scene);
+
+        // so the next load can skip all of the above
+        if (!meshcache::write(path, meshes, textures_loaded))
+            cout << "WARNING::MODEL:: Could not write the mesh cache of " << path << endl;
+        packMeshes();
+        return true;
+    }
+
+    // packs the meshes' vertices down to what the shader reads. the cache keeps the full vertices, so it works with any shader.
+    void packMeshes()
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].pack(attributes, packing);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -85,61 +209,52 @@ private:
 
     Mesh processMesh(aiMesh* mesh, const aiScene* scene)
     {
-        // data to fill
-        vector<Vertex> vertices;
+        // data to fill, sized up front so every vertex and index is written once, in place.
+        vector<Vertex> vertices(mesh->mNumVertices);
         vector<unsigned int> indices;
         vector<Texture> textures;
+        // the attributes the mesh has data for, the vertices are only packed with those
+        unsigned int attributes = VERTEX_POSITION;
+        if (mesh->HasNormals())
+            attributes |= VERTEX_NORMAL;
+        if (mesh->mTextureCoords[0])
+            attributes |= VERTEX_TEXCOORDS | VERTEX_TANGENT | VERTEX_BITANGENT;
 
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
-            glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-            // positions
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.Position = vector;
+            Vertex& vertex = vertices[i];
+            // positions. assimp uses its own vector class that doesn't directly convert to glm's, so we copy the components.
+            vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
             // normals
             if (mesh->HasNormals())
-            {
-                vector.x = mesh->mNormals[i].x;
-                vector.y = mesh->mNormals[i].y;
-                vector.z = mesh->mNormals[i].z;
-                vertex.Normal = vector;
-            }
+                vertex.Normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
             // texture coordinates
             if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
             {
-                glm::vec2 vec;
                 // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
                 // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
+                vertex.TexCoords = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
                 // tangent
-                vector.x = mesh->mTangents[i].x;
-                vector.y = mesh->mTangents[i].y;
-                vector.z = mesh->mTangents[i].z;
-                vertex.Tangent = vector;
+                vertex.Tangent = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
                 // bitangent
-                vector.x = mesh->mBitangents[i].x;
-                vector.y = mesh->mBitangents[i].y;
-                vector.z = mesh->mBitangents[i].z;
-                vertex.Bitangent = vector;
+                vertex.Bitangent = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
             }
-            else
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-            vertices.push_back(vertex);
         }
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        // triangulation can leave points and lines behind, so the faces are counted first.
+        unsigned int indexCount = 0;
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+            indexCount += mesh->mFaces[i].mNumIndices;
+
+        indices.resize(indexCount);
+        unsigned int* index = indices.data();
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for (unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+                *index++ = face.mIndices[j];
         }
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -169,8 +284,8 @@ private:
         std::vector<Texture> aoMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ao");
         textures.insert(textures.end(), aoMaps.begin(), aoMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return a mesh object created from the extracted mesh data, handing it the vectors instead of copying them
+        return Mesh(std::move(vertices), std::move(indices), std::move(textures), attributes);
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -194,9 +309,9 @@ private:
                 }
             }
             if (!skip)
-            {   // if texture hasn't been loaded already, load it
+            {   // if texture hasn't been loaded already, load it once the model is uploaded
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
+                texture.id = 0;
                 texture.type = typeName;
                 texture.path = str.C_Str();
                 textures.push_back(texture);
@@ -216,34 +331,39 @@ unsigned int TextureFromFile(const char* path, const string& directory, bool gam
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    RenderState::get().editTexture(textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        stbi_image_free(data);
-    }
-    else
+    // a grey texel to show until the file is decoded
+    unsigned char placeholder[4] = { 128, 128, 128, 255 };
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+    // read the cooked file, or decode and build the mips, on a worker thread. the texture stream uploads them over the next frames
+    TextureStream* stream = &TextureStream::get();
+
+    jobs::async([textureID, filename, stream]()
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
+        dds::Image image;
+        if (dds::readCooked(filename, image) && stream->supports(image))
+        {
+            stream->add(TextureStream::prepare(textureID, std::move(image)));
+            return;
+        }
+
+        int width, height, nrComponents;
+        unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+        if (!data)
+        {
+            std::cout << "Texture failed to load at path: " << filename << std::endl;
+            return;
+        }
+
+        stream->add(TextureStream::prepare(textureID, data, width, height, nrComponents));
         stbi_image_free(data);
-    }
+    });
 
     return textureID;
 }
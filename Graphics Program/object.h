@@ -9,7 +9,10 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "util.h"
+#include "shader.h"
+#include "renderstate.h"
 #include "model.h"
+#include "drawbatch.h"
 
 class Object
 {
@@ -20,82 +23,80 @@ public:
 
 	Object(string const& _path)
 	{
-		model	= new Model(_path);
+		setup();
+
+		model	= new Model(_path, false, true, false, shader->attributes);
 		pos		= glm::vec3(0, 0, 0);
 		rot		= glm::vec3(0, 0, 0);
 		scale	= glm::vec3(1, 1, 1);
-
-		setup();
 	}
 
 	Object(string const& _path, glm::vec3 _pos, glm::vec3 _rot, glm::vec3 _scale)
 	{
-		model	= new Model(_path);;
+		setup();
+
+		model	= new Model(_path, false, true, false, shader->attributes);
 		pos		= _pos;
 		rot		= _rot;
 		scale	= _scale;
-
-		setup();
 	}
 
-	void draw(glm::mat4 _view, glm::mat4 _projection, glm::vec3 _lightDirection, glm::vec3 _cameraPosition)
+	/// <summary>
+	/// Draws the object, or queues it in the draw batch when the context supports it. The batch draws on DrawBatch::flush.
+	/// </summary>
+	void draw()
 	{
-		//	Enabling blending.
-		//glEnable(GL_BLEND);
+		//	Passing translation data into the program.
+		glm::mat4 world = glm::mat4(1.0f);
+
+		world = glm::translate(world, pos);
+		world = world * glm::toMat4(glm::quat(rot));
+		world = glm::scale(world, scale);
+
+		if (DrawBatch::get().supported)
+		{
+			DrawBatch::get().add(*model, world);
+			return;
+		}
+
+		RenderState& state = RenderState::get();
+
+		//	Blending is off, swap this for state.enable(GL_BLEND) to use one of the modes below.
+		state.disable(GL_BLEND);
 
 		//	Alpha blend.
-		//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		//state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		//	Additive blend.
-		//glBlendFunc(GL_ONE, GL_ONE);
+		//state.blendFunc(GL_ONE, GL_ONE);
 		//	Soft additive blend.
-		//glBlendFunc(GL_ONE_MINUS_DST_COLOR, GL_ONE);
+		//state.blendFunc(GL_ONE_MINUS_DST_COLOR, GL_ONE);
 		//  Multiply blend.
-		//glBlendFunc(GL_DST_COLOR, GL_ZERO);
+		//state.blendFunc(GL_DST_COLOR, GL_ZERO);
 		//  Double multiply blend.
-		//glBlendFunc(GL_DST_COLOR, GL_SRC_COLOR);
+		//state.blendFunc(GL_DST_COLOR, GL_SRC_COLOR);
 
 		//	Configuring GPU options I think??
-		glEnable(GL_DEPTH);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
 
-		glUseProgram(program);
+		state.useProgram(shader->id);
 
-		//	Passing translation data into the program.
-		glm::mat4 world = glm::mat4(1.0f);
-
-		world = glm::translate(world, pos);
-		world = world * glm::toMat4(glm::quat(rot));
-		world = glm::scale(world, scale);
-
-		glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
-		glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(_view));
-		glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(_projection));
-
-		//	Passing world light information into the render program.
-		glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(_lightDirection));
-		glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cameraPosition));
+		glUniformMatrix4fv(worldLocation, 1, GL_FALSE, glm::value_ptr(world));
 
 		//	Calling the model's render program.
-		model->Draw(program);
-
-		//	Disabling blending.
-		glDisable(GL_BLEND);
+		model->Draw(shader->id);
 	}
 
 
 private:
-	GLuint program;
+	Shader* shader;
+	GLint worldLocation;
 
 	void setup()
 	{
-		util::createProgram(program, "shaders/model.vs", "shaders/model.fs");
-		glUseProgram(program);
-		glUniform1i(glGetUniformLocation(program, "texture_diffuse1"), 0);
-		glUniform1i(glGetUniformLocation(program, "texture_specular1"), 1);
-		glUniform1i(glGetUniformLocation(program, "texture_norma1l"), 2);
-		glUniform1i(glGetUniformLocation(program, "texture_roughness1"), 3);
-		glUniform1i(glGetUniformLocation(program, "texture_ao1"), 4);
+		//	Sampler units are set by the meshes, the first time they are drawn with this shader.
+		shader			= new Shader("shaders/model.vs", "shaders/model.fs");
+		worldLocation	= shader->location("world");
 	}
 };
\ No newline at end of file
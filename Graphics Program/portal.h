@@ -2,6 +2,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,8 +15,23 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "util.h"
+#include "shader.h"
+#include "renderstate.h"
 #include "model.h"
 
+/// <summary>
+/// A view through a portal, seen through the portal itself, rendered into a buffer of its own at a lower resolution.
+/// </summary>
+struct PortalView
+{
+	Projection* projection	= NULL;
+	glm::ivec4 scissor		= glm::ivec4(0);
+	int width				= 0;
+	int height				= 0;
+
+	unsigned int frameBuffer = 0, colorBuffer = 0, depthBuffer = 0;
+};
+
 class Portal
 {
 public:
@@ -31,6 +49,38 @@ public:
 	bool inPortal		= false;
 	bool teleportedFlag = false;
 
+	//	Model:
+	Model* sphere = NULL;
+
+	//	Visibility, whether the portal's view has to be rendered this frame. See updateVisibility.
+	bool visible = true;
+
+	//	Part of the screen the portal covers, as a scissor rectangle. (x, y, width, height in pixels)
+	glm::ivec4 scissor = glm::ivec4(0);
+
+	//	Stencil mode: non zero makes the portal mark its pixels with this value instead of showing a texture,
+	//	and the linked view is drawn straight into them. See beginStencilView.
+	GLint stencilReference = 0;
+
+	//	Recursion budget. Where the portal shows up in its own view, that view is rendered again, up to maxDepth levels deep and as long
+	//	as the portal covers at least minCoverage of the screen, every level at levelScale of the resolution of the one before.
+	//	The portal in the last level shows a cached copy of the first one. See updateRecursion.
+	int maxDepth		= 3;
+	float minCoverage	= 0.001f;
+	float levelScale	= 0.5f;
+
+	//	Levels of the portal's view rendered this frame, 1 being just the view itself.
+	int depth = 1;
+
+	//	Level of the portal's own view that's being drawn, or -1 while drawing any other view. Picks what the portal shows.
+	int viewLevel = -1;
+
+	//	Profiling counters.
+	unsigned long long renderedPasses	= 0;
+	unsigned long long skippedPasses	= 0;
+	unsigned long long renderedPixels	= 0;
+	unsigned long long nestedPasses		= 0;
+
 	Portal(Projection* _mainCamera, glm::vec3 _position, float _scale)
 	{
 		baseProjection		= _mainCamera;
@@ -40,10 +90,16 @@ public:
 		scale		= glm::vec3(_scale, _scale, _scale);
 		diameter	= _scale;
 
-		util::createProgram(program, "shaders/portalVertex.shader", "shaders/portalFragment.shader");
+		shader					= new Shader("shaders/portalVertex.shader", "shaders/portalFragment.shader");
+		worldLocation			= shader->location("world");
+		renderTextureLocation	= shader->location("renderTexture");
+		sampleTransformLocation	= shader->location("sampleTransform");
+
+		//	The sphere is small, so half float positions are precise enough.
+		sphere		= new Model("models/portal/portal.obj", false, true, false, shader->attributes, VERTEX_PACK_HALF_POSITION);
+		testTexture	= util::loadTextureAsync("textures/rock.jpg");
 
-		sphere		= new Model("models/portal/portal.obj");
-		testTexture	= util::loadTexture("textures/rock.jpg");
+		glGenQueries(1, &occlusionQuery);
 	}
 
 	void tick()
@@ -99,62 +155,200 @@ public:
 		//	Pitch and yaw always stays the same.
 		portalProjection->pitch	= baseProjection->pitch;
 		portalProjection->yaw	= baseProjection->yaw;
+
+		clipToLinkedPortal(portalProjection);
 		portalProjection->recalculate();
 	}
 
-	void draw(glm::mat4 _view, glm::mat4 _projection, glm::vec3 _lightDirection, glm::vec3 _cameraPosition, unsigned int& _renderTexture)
+	/// <summary>
+	/// Decides whether the portal's view has to be rendered this frame: its sphere has to be inside the main camera's frustum,
+	/// and not have been hidden behind something when it was last drawn. The occlusion result is read back from an earlier
+	/// frame without waiting on it, so a portal coming out from behind something shows its last view for a frame or two.
+	/// Visible portals also narrow their view down to the part of the screen they cover, see updateFootprint, and find out how
+	/// deep to render their view of themselves, see updateRecursion. Call this after updatePortalProjection.
+	/// </summary>
+	bool updateVisibility()
 	{
-		if (!enabled) return;
+		//	Picking up the result of the last query, if it's in.
+		if (queryPending)
+		{
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(occlusionQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+
+			if (available == GL_TRUE)
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv(occlusionQuery, GL_QUERY_RESULT, &samples);
+
+				occluded		= samples == 0;
+				queryPending	= false;
+			}
+		}
+
+		glm::vec3 center;
+		float radius;
+		boundingSphere(center, radius);
+
+		inFrustum = baseProjection->frustum.intersects(center, radius);
+
+		//	Occlusion results are only kept while the sphere stays in view, so a portal entering the view is always rendered.
+		if (!inFrustum) occluded = false;
+
+		//	Up close the sphere gets clipped by the near plane, or surrounds the camera, where the query can't be trusted.
+		bool close = glm::length(baseProjection->position - center) < radius * 1.1f;
+
+		visible = close || (inFrustum && !occluded);
+
+		if (visible)
+		{
+			updateFootprint(center, radius, close);
+
+			renderedPasses++;
+			renderedPixels += (unsigned long long)scissor.z * scissor.w;
+
+			updateRecursion(center, radius);
+		}
+		else
+		{
+			skippedPasses++;
+		}
+
+		return visible;
+	}
+
+	void draw(unsigned int& _renderTexture)
+	{
+		if (!enabled || !inFrustum) return;
 
 		//	Configuring options.
-		glEnable(GL_DEPTH);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
+		RenderState& state = RenderState::get();
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+		state.disable(GL_BLEND);
 
 		//	Prioritizing program.
-		glUseProgram(program);
+		state.useProgram(shader->id);
 
 		//	Passing translation data into the program.
-		glm::mat4 world = glm::mat4(1.0f);
+		glUniformMatrix4fv(worldLocation, 1, GL_FALSE, glm::value_ptr(worldMatrix()));
 
-		world = glm::translate(world, pos);
-		world = world * glm::toMat4(glm::quat(glm::vec3(0, 0, 0)));
-		world = glm::scale(world, scale);
+		//	Create a variable for the portal view, and where in it to sample.
+		unsigned int portalTexture	= 0;
+		glm::vec4 sampleTransform	= glm::vec4(1, 1, 0, 0);
 
-		glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
-		glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(_view));
-		glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(_projection));
+		//	If there's not linked portal, display a test texture through the portal instead.
+		//	Inside its own view the portal shows the next level, and in the last level the cache, stretched over it.
+		if (linkedPortal == NULL)			portalTexture = testTexture;
+		else if (viewLevel < 0)				portalTexture = _renderTexture;
+		else if (viewLevel + 1 < depth)		portalTexture = nestedViews[viewLevel].colorBuffer;
+		else
+		{
+			portalTexture	= cache.colorBuffer;
+			sampleTransform	= cacheTransform;
+		}
 
-		//	Passing world light information into the render program.
-		glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(_lightDirection));
-		glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cameraPosition));
+		//	Bind and pass the portal texture.
+		state.bindTexture(0, portalTexture);
+		glUniform1i(renderTextureLocation, 0);
+		glUniform4fv(sampleTransformLocation, 1, glm::value_ptr(sampleTransform));
 
-		//	Create a variable for the portal view.
-		unsigned int portalTexture = 0;
+		//	In stencil mode only the stencil and depth are written. Until the linked view is drawn over them, the pixels keep what's behind the portal.
+		if (stencilReference != 0)
+		{
+			state.enable(GL_STENCIL_TEST);
+			glStencilFunc(GL_ALWAYS, stencilReference, 0xFF);
+			glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		}
 
-		//	If there's not linked portal, display a test texture through the portal instead.
-		if (linkedPortal != NULL)	portalTexture = _renderTexture;
-		else						portalTexture = testTexture;
+		//	Calling the model's render program, counting the samples that pass for the next frames' visibility.
+		//	A new query is only started once the last one's result is in, and only in the main view.
+		bool query = !queryPending && sphere->loaded && viewLevel < 0;
 
-		//	Bind and pass the portal texture.
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, portalTexture);
-		glUniform1i(glGetUniformLocation(program, "renderTexture"),	0);
+		if (query) glBeginQuery(GL_ANY_SAMPLES_PASSED, occlusionQuery);
+		sphere->Draw(shader->id);
+		if (query) glEndQuery(GL_ANY_SAMPLES_PASSED);
 
-		//	Calling the model's render program.
-		sphere->Draw(program);
+		queryPending |= query;
 
-		//	Disabling blending.
-		glDisable(GL_BLEND);
+		if (stencilReference != 0)
+		{
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			state.disable(GL_STENCIL_TEST);
+		}
+	}
+
+	/// <summary>
+	/// Stencil mode: limits drawing to the pixels the portal marked in the main view, and pushes their depth back to the far plane,
+	/// so the linked view can be drawn into them as if they were cleared. Call this with the main camera's FrameData bound,
+	/// which drawing another portal's view replaces, and endStencilView once the linked view is drawn.
+	/// </summary>
+	void beginStencilView()
+	{
+		RenderState& state = RenderState::get();
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+		state.enable(GL_STENCIL_TEST);
+		state.useProgram(shader->id);
+
+		glStencilFunc(GL_EQUAL, stencilReference, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+		//	Drawing the sphere again over its own pixels, writing nothing but the far plane's depth.
+		glUniformMatrix4fv(worldLocation, 1, GL_FALSE, glm::value_ptr(worldMatrix()));
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthFunc(GL_ALWAYS);
+		glDepthRange(1.0, 1.0);
+
+		sphere->Draw(shader->id);
+
+		glDepthRange(0.0, 1.0);
+		glDepthFunc(GL_LESS);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	void endStencilView()
+	{
+		RenderState::get().disable(GL_STENCIL_TEST);
+	}
+
+	/// <summary>
+	/// Returns a level of the portal's view of itself, from 1 up to depth - 1. Level 0 is the portal's own view.
+	/// </summary>
+	const PortalView& nestedView(int _level) const
+	{
+		return nestedViews[_level - 1];
+	}
+
+	/// <summary>
+	/// Copies the part of the portal's view it covers on screen into the cache, at the resolution of the first nested level,
+	/// for the last level to show next frame. Call this after drawing the view, with the scissor test off.
+	/// </summary>
+	void cacheView(unsigned int _frameBuffer)
+	{
+		if (linkedPortal == NULL || stencilReference != 0) return;
+		if (cache.frameBuffer == 0) createView(cache, 1);
+
+		glm::vec2 size	= glm::vec2(baseProjection->width, baseProjection->height);
+		glm::vec2 ratio	= glm::vec2(cache.width, cache.height) / size;
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, _frameBuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.frameBuffer);
+		glBlitFramebuffer(scissor.x, scissor.y, scissor.x + scissor.z, scissor.y + scissor.w,
+			(GLint)(scissor.x * ratio.x), (GLint)(scissor.y * ratio.y), (GLint)((scissor.x + scissor.z) * ratio.x), (GLint)((scissor.y + scissor.w) * ratio.y),
+			GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		cacheMin = glm::vec2(scissor.x, scissor.y) / size;
+		cacheMax = glm::vec2(scissor.x + scissor.z, scissor.y + scissor.w) / size;
 	}
 
 private:
 	//	Shader:
-	GLuint program;
-
-	//	Model:
-	Model* sphere = NULL;
+	Shader* shader;
+	GLint worldLocation, renderTextureLocation, sampleTransformLocation;
 
 	//	Camera view:
 	Projection* baseProjection = NULL;
@@ -162,4 +356,212 @@ private:
 	//	Debug:
 	GLuint testTexture;
 
+	//	Visibility:
+	GLuint occlusionQuery	= 0;
+	bool queryPending		= false;
+	bool occluded			= false;
+	bool inFrustum			= true;
+
+	//	Footprint of the portal's view, in normalized device coordinates.
+	glm::vec2 footprintMin = glm::vec2(-1.0f), footprintMax = glm::vec2(1.0f);
+
+	//	Recursion. The cache holds last frame's view over the rectangle cacheMin to cacheMax, in texture coordinates,
+	//	and cacheTransform maps the last level's portal onto it.
+	std::vector<PortalView> nestedViews;
+	PortalView cache;
+	glm::vec2 cacheMin = glm::vec2(0.0f), cacheMax = glm::vec2(1.0f);
+	glm::vec4 cacheTransform = glm::vec4(1, 1, 0, 0);
+
+	/// <summary>
+	/// Clips a view through the portal at the plane touching the near side of the linked portal's sphere, facing away from the view.
+	/// Everything in front of it is between the view and the linked portal, where this portal shows nothing of it, so it isn't drawn.
+	/// Views inside or right next to the sphere keep the regular near plane. Recalculate the view afterwards.
+	/// </summary>
+	void clipToLinkedPortal(Projection* _view)
+	{
+		_view->clipped = false;
+		if (linkedPortal == NULL) return;
+
+		glm::vec3 center;
+		float radius;
+		linkedPortal->boundingSphere(center, radius);
+
+		glm::vec3 offset	= center - _view->position;
+		float distance		= glm::length(offset);
+		if (distance < radius * 1.1f) return;
+
+		glm::vec3 normal	= offset / distance;
+		glm::vec3 point		= center - normal * radius;
+
+		_view->clipped		= true;
+		_view->clipPlane	= glm::vec4(normal, -glm::dot(normal, point));
+	}
+
+	/// <summary>
+	/// Finds the rectangle the sphere covers on screen, from the corners of its bounding box, and constrains the portal view's
+	/// frustum to it. The portal samples its view at the same screen position, so nothing outside of it is ever seen.
+	/// </summary>
+	void updateFootprint(const glm::vec3& _center, float _radius, bool _close)
+	{
+		//	Boxes reaching behind the camera don't project to a rectangle, those keep the whole screen.
+		bool whole = _close || !project(baseProjection, _center, _radius, footprintMin, footprintMax);
+		if (whole)
+		{
+			footprintMin = glm::vec2(-1.0f);
+			footprintMax = glm::vec2(1.0f);
+		}
+
+		scissor = toScissor(footprintMin, footprintMax, baseProjection->width, baseProjection->height);
+
+		if (!whole) portalProjection->constrain(footprintMin, footprintMax);
+	}
+
+	/// <summary>
+	/// Follows the portal through its own view. Wherever the view shows the portal again, the view through that is another
+	/// step along towards the linked portal, seen only through the part of the screen the portal covers there. Levels are
+	/// added while the budget allows, and the portal in the last one is mapped onto the cached first level instead.
+	/// </summary>
+	void updateRecursion(const glm::vec3& _center, float _radius)
+	{
+		depth = 1;
+		if (linkedPortal == NULL || stencilReference != 0) return;
+
+		glm::vec3 step		= linkedPortal->pos - pos;
+		Projection* outer	= portalProjection;
+		glm::vec2 outerMin	= footprintMin, outerMax = footprintMax;
+		glm::vec2 innerMin	= outerMin, innerMax = outerMax;
+
+		while (outer->frustum.intersects(_center, _radius))
+		{
+			//	Where the portal shows up in the view, which is only ever seen through the view's own footprint.
+			if (!project(outer, _center, _radius, innerMin, innerMax))
+			{
+				innerMin = outerMin;
+				innerMax = outerMax;
+				break;
+			}
+
+			innerMin = glm::max(innerMin, outerMin);
+			innerMax = glm::min(innerMax, outerMax);
+			if (innerMax.x <= innerMin.x || innerMax.y <= innerMin.y) break;
+
+			//	Out of budget, the portal shows the cache at this level.
+			float coverage = (innerMax.x - innerMin.x) * (innerMax.y - innerMin.y) / 4.0f;
+			if (depth >= maxDepth || coverage < minCoverage) break;
+
+			if ((int)nestedViews.size() < depth)
+			{
+				nestedViews.push_back(PortalView());
+				nestedViews.back().projection = new Projection(baseProjection->width, baseProjection->height);
+				createView(nestedViews.back(), depth);
+			}
+
+			PortalView& view			= nestedViews[depth - 1];
+			view.projection->position	= outer->position + step;
+			view.projection->pitch		= baseProjection->pitch;
+			view.projection->yaw		= baseProjection->yaw;
+
+			clipToLinkedPortal(view.projection);
+			view.projection->recalculate();
+			view.projection->constrain(innerMin, innerMax);
+
+			view.scissor = toScissor(innerMin, innerMax, view.width, view.height);
+
+			nestedPasses++;
+			renderedPixels += (unsigned long long)view.scissor.z * view.scissor.w;
+
+			outer		= view.projection;
+			outerMin	= innerMin;
+			outerMax	= innerMax;
+			depth++;
+		}
+
+		//	Mapping the last portal's rectangle onto the cached one, in texture coordinates.
+		glm::vec2 from	= innerMin * 0.5f + 0.5f;
+		glm::vec2 scale	= (cacheMax - cacheMin) / glm::max((innerMax - innerMin) * 0.5f, glm::vec2(1e-4f));
+
+		cacheTransform = glm::vec4(scale, cacheMin - from * scale);
+	}
+
+	/// <summary>
+	/// Finds the rectangle the sphere covers as seen from a projection, in normalized device coordinates, from the corners
+	/// of its bounding box. Returns false if the box reaches behind the projection, which doesn't project to a rectangle.
+	/// </summary>
+	bool project(const Projection* _projection, const glm::vec3& _center, float _radius, glm::vec2& _min, glm::vec2& _max) const
+	{
+		glm::mat4 viewProjection = _projection->projection * _projection->view;
+
+		_min = glm::vec2(1.0f);
+		_max = glm::vec2(-1.0f);
+
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner	= _center + glm::vec3(i & 1 ? _radius : -_radius, i & 2 ? _radius : -_radius, i & 4 ? _radius : -_radius);
+			glm::vec4 clip		= viewProjection * glm::vec4(corner, 1.0f);
+
+			if (clip.w <= 0.0f) return false;
+
+			glm::vec2 ndc	= glm::vec2(clip) / clip.w;
+			_min			= glm::min(_min, ndc);
+			_max			= glm::max(_max, ndc);
+		}
+
+		_min = glm::clamp(_min, glm::vec2(-1.0f), glm::vec2(1.0f));
+		_max = glm::clamp(_max, glm::vec2(-1.0f), glm::vec2(1.0f));
+
+		return true;
+	}
+
+	/// <summary>
+	/// Turns a rectangle in normalized device coordinates into a scissor rectangle of a buffer, with a pixel of margin for rounding.
+	/// </summary>
+	glm::ivec4 toScissor(const glm::vec2& _min, const glm::vec2& _max, int _width, int _height) const
+	{
+		glm::vec2 size	= glm::vec2(_width, _height);
+		glm::ivec2 low	= glm::max(glm::ivec2(glm::floor((_min * 0.5f + 0.5f) * size)) - 1, glm::ivec2(0));
+		glm::ivec2 high	= glm::min(glm::ivec2(glm::ceil((_max * 0.5f + 0.5f) * size)) + 1, glm::ivec2(size));
+
+		return glm::ivec4(low, glm::max(high - low, glm::ivec2(0)));
+	}
+
+	/// <summary>
+	/// Sets up the buffer of a nested level, at levelScale to the power of the level of the screen's resolution.
+	/// </summary>
+	void createView(PortalView& _view, int _level)
+	{
+		float resolution	= std::pow(levelScale, (float)_level);
+		_view.width			= std::max((int)(baseProjection->width * resolution), 1);
+		_view.height		= std::max((int)(baseProjection->height * resolution), 1);
+
+		util::createFrameBuffer(_view.width, _view.height, _view.frameBuffer, _view.colorBuffer, _view.depthBuffer);
+	}
+
+	glm::mat4 worldMatrix() const
+	{
+		glm::mat4 world = glm::mat4(1.0f);
+
+		world = glm::translate(world, pos);
+		world = world * glm::toMat4(glm::quat(glm::vec3(0, 0, 0)));
+		world = glm::scale(world, scale);
+
+		return world;
+	}
+
+	/// <summary>
+	/// Bounding sphere of the portal in world space, from the model once it's loaded.
+	/// </summary>
+	void boundingSphere(glm::vec3& _center, float& _radius) const
+	{
+		_center = pos;
+		_radius = diameter / 2;
+
+		if (!sphere->loaded) return;
+
+		glm::vec3 center;
+		sphere->boundingSphere(center, _radius);
+
+		_center = pos + center * scale;
+		_radius *= std::max(scale.x, std::max(scale.y, scale.z));
+	}
+
 };
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#include "frustum.h"
+
 class Projection
 {
 public:
@@ -18,6 +20,11 @@ public:
 	int height			= 0;
 
 	glm::mat4 view, projection;
+	Frustum frustum;
+
+	//	Oblique near plane, in world space, that replaces the regular one while clipped is set. (xyz = normal facing away from the camera, w = distance)
+	bool clipped		= false;
+	glm::vec4 clipPlane	= glm::vec4(0);
 
 	Projection(int _width, int _height)
 	{
@@ -45,8 +52,51 @@ public:
 
 		view		= glm::lookAt(position, position + camForward, camUp);
 		projection	= glm::perspective(glm::radians(75.0f), width / (float)height, 0.1f, 5000.0f);
+
+		if (clipped) clipNearPlane();
+
+		frustum.extract(projection * view);
+	}
+
+	/// <summary>
+	/// Narrows the frustum down to a rectangle of the screen, in normalized device coordinates, for views that only
+	/// show through part of the screen. The projection itself stays the same, so this only affects culling.
+	/// </summary>
+	void constrain(const glm::vec2& _min, const glm::vec2& _max)
+	{
+		//	Stretching the rectangle over the whole clip space, and taking the planes of that.
+		glm::vec2 size		= glm::max(_max - _min, glm::vec2(1e-4f));
+		glm::mat4 crop		= glm::mat4(1.0f);
+		crop[0][0]			= 2.0f / size.x;
+		crop[1][1]			= 2.0f / size.y;
+		crop[3][0]			= -(_max.x + _min.x) / size.x;
+		crop[3][1]			= -(_max.y + _min.y) / size.y;
+
+		frustum.extract(crop * projection * view);
 	}
 
 protected:
 	glm::quat camQuat;
+
+	/// <summary>
+	/// Turns the projection into one whose near plane is clipPlane, so everything between the camera and the plane is
+	/// clipped by the rasterizer, and culled by the frustum. Eric Lengyel's oblique view frustum: the far plane tilts along,
+	/// which only cuts off a little of the far corners. Planes the camera isn't in front of keep the regular near plane.
+	/// </summary>
+	void clipNearPlane()
+	{
+		//	Planes transform by the inverse transpose, which for the view is just the rotation and translation.
+		glm::vec4 plane = glm::transpose(glm::inverse(view)) * clipPlane;
+		if (plane.w > -0.1f) return;
+
+		//	The corner of the frustum opposite the plane, moved onto the far plane by the scale.
+		glm::vec4 corner	= glm::inverse(projection) * glm::vec4(glm::sign(plane.x), glm::sign(plane.y), 1.0f, 1.0f);
+		glm::vec4 scaled	= plane * (2.0f / glm::dot(plane, corner));
+
+		//	Third row becomes the plane minus the fourth.
+		projection[0][2]	= scaled.x - projection[0][3];
+		projection[1][2]	= scaled.y - projection[1][3];
+		projection[2][2]	= scaled.z - projection[2][3];
+		projection[3][2]	= scaled.w - projection[3][3];
+	}
 };
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <glad/glad.h>
+
+//	Amount of texture units the cache keeps track of.
+#define RENDER_STATE_TEXTURE_UNITS 16
+
+//	Sentinel for state we haven't set yet, and thus don't know.
+#define RENDER_STATE_UNKNOWN 0xFFFFFFFF
+
+/// <summary>
+/// Shadow copy of the GL state the renderer touches, so calls that wouldn't change anything are skipped.
+/// Everything that binds programs, vertex arrays or textures, or toggles the tracked capabilities, should go through here.
+/// </summary>
+class RenderState
+{
+public:
+	//	Profiling counters.
+	unsigned long long issuedCalls	= 0;
+	unsigned long long avoidedCalls	= 0;
+
+	/// <summary>
+	/// Returns the state of the current context.
+	/// </summary>
+	static RenderState& get()
+	{
+		static RenderState state;
+		return state;
+	}
+
+	void useProgram(GLuint _program)
+	{
+		if (!changed(program, _program)) return;
+		glUseProgram(_program);
+	}
+
+	void bindVertexArray(GLuint _vertexArray)
+	{
+		if (!changed(vertexArray, _vertexArray)) return;
+		glBindVertexArray(_vertexArray);
+	}
+
+	/// <summary>
+	/// Binds a 2D texture to a texture unit. (0 based, not GL_TEXTURE0 based)
+	/// </summary>
+	void bindTexture(GLuint _unit, GLuint _texture)
+	{
+		if (!changed(textures[_unit], _texture)) return;
+
+		if (changed(activeUnit, _unit)) glActiveTexture(GL_TEXTURE0 + _unit);
+		glBindTexture(GL_TEXTURE_2D, _texture);
+	}
+
+	/// <summary>
+	/// Binds a 2D texture to unit 0 for creating or uploading to it, rather than drawing with it. Unlike bindTexture, unit 0 is
+	/// always made active, even if the texture was bound there already, so the glTex calls that follow can't hit another unit's texture.
+	/// </summary>
+	void editTexture(GLuint _texture)
+	{
+		if (changed(activeUnit, 0)) glActiveTexture(GL_TEXTURE0);
+		if (changed(textures[0], _texture)) glBindTexture(GL_TEXTURE_2D, _texture);
+	}
+
+	/// <summary>
+	/// Deletes a 2D texture, forgetting it on every unit it was bound to. GL unbinds deleted textures, and the name may come back from glGenTextures.
+	/// </summary>
+	void deleteTexture(GLuint _texture)
+	{
+		for (int i = 0; i < RENDER_STATE_TEXTURE_UNITS; i++)
+		{
+			if (textures[i] == _texture) textures[i] = 0;
+		}
+
+		glDeleteTextures(1, &_texture);
+	}
+
+	/// <summary>
+	/// Deletes a program, forgetting it if it's in use. GL keeps a deleted program in use until another one is, and the name may come back from glCreateProgram.
+	/// </summary>
+	void deleteProgram(GLuint _program)
+	{
+		if (program == _program) useProgram(0);
+		glDeleteProgram(_program);
+	}
+
+	void enable(GLenum _capability)
+	{
+		setCapability(_capability, true);
+	}
+
+	void disable(GLenum _capability)
+	{
+		setCapability(_capability, false);
+	}
+
+	void cullFace(GLenum _face)
+	{
+		if (!changed(cullFaceMode, _face)) return;
+		glCullFace(_face);
+	}
+
+	void blendFunc(GLenum _source, GLenum _destination)
+	{
+		bool sourceChanged		= blendSource != _source;
+		bool destinationChanged	= blendDestination != _destination;
+
+		if (!sourceChanged && !destinationChanged)
+		{
+			avoidedCalls++;
+			return;
+		}
+
+		issuedCalls++;
+		blendSource			= _source;
+		blendDestination	= _destination;
+		glBlendFunc(_source, _destination);
+	}
+
+	/// <summary>
+	/// Forgets everything, for when the state was changed behind the cache's back.
+	/// </summary>
+	void invalidate()
+	{
+		program = vertexArray = activeUnit = cullFaceMode = blendSource = blendDestination = RENDER_STATE_UNKNOWN;
+
+		for (int i = 0; i < RENDER_STATE_TEXTURE_UNITS; i++)	textures[i]		= RENDER_STATE_UNKNOWN;
+		for (int i = 0; i < CAPABILITY_COUNT; i++)				capabilities[i]	= RENDER_STATE_UNKNOWN;
+	}
+
+	void resetCounters()
+	{
+		issuedCalls		= 0;
+		avoidedCalls	= 0;
+	}
+
+private:
+	enum { CAPABILITY_DEPTH_TEST, CAPABILITY_CULL_FACE, CAPABILITY_BLEND, CAPABILITY_STENCIL_TEST, CAPABILITY_SCISSOR_TEST, CAPABILITY_COUNT };
+
+	GLuint program, vertexArray, activeUnit;
+	GLuint textures[RENDER_STATE_TEXTURE_UNITS];
+	GLuint capabilities[CAPABILITY_COUNT];
+	GLenum cullFaceMode, blendSource, blendDestination;
+
+	RenderState()
+	{
+		invalidate();
+	}
+
+	/// <summary>
+	/// Updates a cached value, and counts whether the GL call for it is needed.
+	/// </summary>
+	/// <returns>True if the value changed and the call should be issued.</returns>
+	bool changed(GLuint& _cached, GLuint _value)
+	{
+		if (_cached == _value)
+		{
+			avoidedCalls++;
+			return false;
+		}
+
+		issuedCalls++;
+		_cached = _value;
+		return true;
+	}
+
+	void setCapability(GLenum _capability, bool _enabled)
+	{
+		int index = -1;
+		switch (_capability)
+		{
+			case GL_DEPTH_TEST:		index = CAPABILITY_DEPTH_TEST;		break;
+			case GL_CULL_FACE:		index = CAPABILITY_CULL_FACE;		break;
+			case GL_BLEND:			index = CAPABILITY_BLEND;			break;
+			case GL_STENCIL_TEST:	index = CAPABILITY_STENCIL_TEST;	break;
+			case GL_SCISSOR_TEST:	index = CAPABILITY_SCISSOR_TEST;	break;
+		}
+
+		//	Untracked capabilities are always passed on.
+		if (index >= 0 && !changed(capabilities[index], _enabled ? 1 : 0)) return;
+		if (index < 0) issuedCalls++;
+
+		if (_enabled)	glEnable(_capability);
+		else			glDisable(_capability);
+	}
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "util.h"
+#include "projection.h"
+#include "vertexformat.h"
+
+//	Uniform buffer binding point of the FrameData block.
+#define FRAME_DATA_BINDING 0
+
+/// <summary>
+/// Data shared by every program during a pass. Matches the std140 FrameData block in the shaders,
+/// where each vec3 is aligned to 16 bytes.
+/// </summary>
+struct FrameData
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 cameraPosition;
+	glm::vec4 lightDirection;
+};
+
+/// <summary>
+/// Program wrapper that looks up every uniform location once, at link time.
+/// </summary>
+class Shader
+{
+public:
+	GLuint id = 0;
+
+	//	Vertex attributes the program reads, as VERTEX_* bits of their locations. Meshes only need to upload these.
+	unsigned int attributes = 0;
+
+	Shader(const char* _vertex, const char* _fragment)
+	{
+		util::createProgram(id, _vertex, _fragment);
+		reflect();
+	}
+
+	~Shader()
+	{
+		RenderState::get().deleteProgram(id);
+	}
+
+	/// <summary>
+	/// Returns the cached location of a uniform, or -1 if the program doesn't have it.
+	/// Meant for setup; store the result instead of calling this every draw.
+	/// </summary>
+	GLint location(const std::string& _name) const
+	{
+		auto it = uniforms.find(_name);
+		return it != uniforms.end() ? it->second : -1;
+	}
+
+private:
+	std::unordered_map<std::string, GLint> uniforms;
+
+	/// <summary>
+	/// Caches the location of every active uniform, finds the vertex attributes the program reads, and hooks the FrameData block up to its binding point.
+	/// </summary>
+	void reflect()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(id, GL_ACTIVE_UNIFORMS,				&count);
+		glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH,	&maxLength);
+
+		std::vector<char> name(maxLength + 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length;
+			GLint size;
+			GLenum type;
+			glGetActiveUniform(id, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+			//	Uniforms inside a block don't have a location.
+			GLint uniformLocation = glGetUniformLocation(id, name.data());
+			if (uniformLocation < 0) continue;
+
+			//	Arrays are reported as "name[0]", so also store them by their plain name.
+			std::string uniformName(name.data(), length);
+			uniforms[uniformName] = uniformLocation;
+
+			size_t bracket = uniformName.find('[');
+			if (bracket != std::string::npos) uniforms[uniformName.substr(0, bracket)] = uniformLocation;
+		}
+
+		//	Matrices take up a location per column.
+		glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES,			&count);
+		glGetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH,	&maxLength);
+
+		name.resize(maxLength + 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length;
+			GLint size;
+			GLenum type;
+			glGetActiveAttrib(id, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+			GLint attributeLocation = glGetAttribLocation(id, name.data());
+			if (attributeLocation < 0) continue;
+
+			int columns = type == GL_FLOAT_MAT4 ? 4 : (type == GL_FLOAT_MAT3 ? 3 : (type == GL_FLOAT_MAT2 ? 2 : 1));
+			for (int j = 0; j < size * columns && attributeLocation + j < 32; j++) attributes |= 1u << (attributeLocation + j);
+		}
+
+		GLuint block = glGetUniformBlockIndex(id, "FrameData");
+		if (block != GL_INVALID_INDEX) glUniformBlockBinding(id, block, FRAME_DATA_BINDING);
+	}
+};
+
+/// <summary>
+/// Uniform buffer holding the FrameData of the current pass, uploaded once per pass instead of once per object.
+/// </summary>
+class FrameUniforms
+{
+public:
+	FrameUniforms()
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	/// <summary>
+	/// Uploads the view of a projection, to be used by every following draw.
+	/// </summary>
+	void upload(const Projection* _projection, glm::vec3 _lightDirection)
+	{
+		FrameData data;
+		data.view			= _projection->view;
+		data.projection		= _projection->projection;
+		data.cameraPosition	= glm::vec4(_projection->position, 1.0f);
+		data.lightDirection	= glm::vec4(_lightDirection, 0.0f);
+
+		//	Orphaning the previous pass' storage, so we don't wait on draws still reading it.
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, buffer);
+	}
+
+private:
+	GLuint buffer;
+};
@@ -3,8 +3,13 @@ out vec4 FragColor;
 
 in vec4	worldPosition;
 
-uniform vec3 lightDirection;
-uniform vec3 cameraPosition;
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec3 cameraPosition;
+	vec3 lightDirection;
+};
 
 vec3 lerp(vec3 a, vec3 b, float t)
 {
@@ -2,10 +2,19 @@
 layout(location = 0) in vec3 aPos;
 
 out vec4 worldPosition;
-uniform mat4 world, view, projection;
+uniform mat4 world;
+
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec3 cameraPosition;
+	vec3 lightDirection;
+};
 
 void main()
 {
-	gl_Position		= projection * view * world * vec4(aPos, 1.0);
+	//	Depth is kept at the far plane, so an oblique near plane can't clip the box.
+	gl_Position		= (projection * view * world * vec4(aPos, 1.0)).xyww;
 	worldPosition	= mat4(world) * vec4(aPos, 1.0);
 }
\ No newline at end of file
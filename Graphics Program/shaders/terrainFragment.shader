@@ -3,14 +3,17 @@ out vec4 FragColor;
 
 in vec2	uv;
 in vec3	worldPosition;
-
-uniform sampler2D diffuseTex;
-uniform sampler2D normalTex;
+in vec3	normal;
 
 uniform sampler2D dirt, sand, grass, rock, snow;
 
-uniform vec3 lightDirection;
-uniform vec3 cameraPosition;
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec3 cameraPosition;
+	vec3 lightDirection;
+};
 
 vec3 lerp(vec3 a, vec3 b, float t)
 {
@@ -19,19 +22,15 @@ vec3 lerp(vec3 a, vec3 b, float t)
 
 void main()
 {
-	//	Normal calculation.
-	vec3 normal	= texture(normalTex, uv).rgb;
-	normal		= normalize(normal * 2.0 - 1.0);
-	normal.gb	= normal.bg;						//	Flip normal channels because of conventions
-	normal.r	= -normal.r;						//	Flips red axis.
-	normal.b	= -normal.b;						//	Flips blue axis.
+	//	Normal calculation. (Interpolated, so renormalized)
+	vec3 n = normalize(normal);
 
 	//	Specular data
 	vec3 viewDir		= normalize(worldPosition.rgb - cameraPosition);
-	//vec3 reflDir		= normalize(reflect(lightDirection, normal));
+	//vec3 reflDir		= normalize(reflect(lightDirection, n));
 	
 	//	Lighting
-	float lightValue	= max(-dot(normal, lightDirection), 0.0);
+	float lightValue	= max(-dot(n, lightDirection), 0.0);
 	//float specular		= pow(max(-dot(reflDir, viewDir), 0.0), 64);
 
 	//	Build color!
@@ -1,27 +1,57 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 vNormal;
-layout(location = 2) in vec2 vUV;
+layout(location = 0) in float aHeight;
+layout(location = 1) in float aSurfaceHeight;
+layout(location = 2) in vec2 aNormal;
 
 out vec2 uv;
 out vec3 worldPosition;
+out vec3 normal;
 
-uniform mat4 world, view, projection;
+uniform mat4 world;
 
-uniform sampler2D diffuseTex;
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec3 cameraPosition;
+	vec3 lightDirection;
+};
+
+//	Grid description, vertices only store their heights.
+uniform ivec2 heightmapSize;
+uniform int chunkSize;
+uniform int chunkColumns;
+uniform float xzScale;
+uniform float heightRange;
+
+vec3 decodeNormal(vec2 encoded)
+{
+	vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+
+	return normalize(n);
+}
 
 void main()
 {
+	//	Grid position, from the vertex' place in its chunk's block. (gl_VertexID includes the chunk's base vertex)
+	int chunkVertices	= (chunkSize + 1) * (chunkSize + 1);
+	int chunk			= gl_VertexID / chunkVertices;
+	int local			= gl_VertexID % chunkVertices;
+
+	ivec2 grid	= ivec2(chunk % chunkColumns, chunk / chunkColumns) * chunkSize + ivec2(local % (chunkSize + 1), local / (chunkSize + 1));
+	grid		= min(grid, heightmapSize - 1);
+
 	//	Object space offset.
-	vec3 pos = aPos;
+	vec3 pos = vec3(grid.x * xzScale, aHeight * heightRange, grid.y * xzScale);
 
 	//	World space offset.
 	vec4 worldPos = world * vec4(pos, 1.0);
 
-	worldPos.y += texture(diffuseTex, vUV).r * 100.0f;
-
 	gl_Position	= projection * view * worldPos;
-	uv			= vUV;
+	uv			= vec2(grid) / vec2(heightmapSize);
+	normal		= mat3(world) * decodeNormal(aNormal);
 
-	worldPosition = mat3(world) * aPos;
-}
\ No newline at end of file
+	//	Ground colors are based on the surface, without the displacement.
+	worldPosition = mat3(world) * vec3(pos.x, aSurfaceHeight * heightRange, pos.z);
+}
@@ -9,6 +9,8 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "util.h"
+#include "shader.h"
+#include "renderstate.h"
 
 class Skybox
 {
@@ -18,47 +20,40 @@ public:
 	Skybox()
 	{
 		//	Creating the shader.
-		util::createProgram(program, "shaders/skyVertex.shader", "shaders/skyFragment.shader");
+		shader			= new Shader("shaders/skyVertex.shader", "shaders/skyFragment.shader");
+		worldLocation	= shader->location("world");
 
 		//	Creating the box.
 		createGeometry(boxVAO, boxEBO, boxSize, boxIndexCount);
 	}
 
-	void draw(glm::mat4 _view, glm::mat4 _projection, glm::vec3 _cameraPosition)
+	void draw(glm::vec3 _cameraPosition)
 	{
-		//	Configuring options.
-		glDisable(GL_CULL_FACE);
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_DEPTH);
+		//	Configuring options. Everything that draws after us sets the state it needs itself.
+		RenderState& state = RenderState::get();
+		state.disable(GL_CULL_FACE);
+		state.disable(GL_DEPTH_TEST);
+		state.disable(GL_BLEND);
 
 		//	Setting current program.
-		glUseProgram(program);
+		state.useProgram(shader->id);
 
 		//	Creating world matrix.
 		glm::mat4 world	= glm::mat4(1.0f);
 		world			= glm::translate(world, _cameraPosition);
 		world			= glm::scale(world, glm::vec3(100, 100, 100));
 
-		//	Injecting projection data.
-		glUniformMatrix4fv(glGetUniformLocation(program, "world"),		1, GL_FALSE, glm::value_ptr(world));
-		glUniformMatrix4fv(glGetUniformLocation(program, "view"),		1, GL_FALSE, glm::value_ptr(_view));
-		glUniformMatrix4fv(glGetUniformLocation(program, "projection"),	1, GL_FALSE, glm::value_ptr(_projection));
-
-		//	Injecting relevant vectors.
-		glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(lightDirection));
-		glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cameraPosition));
+		//	Injecting world matrix. View, projection and vectors come from the FrameData block.
+		glUniformMatrix4fv(worldLocation, 1, GL_FALSE, glm::value_ptr(world));
 
 		//	Drawing!
-		glBindVertexArray(boxVAO);
+		state.bindVertexArray(boxVAO);
 		glDrawElements(GL_TRIANGLES, boxIndexCount, GL_UNSIGNED_INT, 0);
-
-		//	Re-enabling some stuff.
-		glEnable(GL_CULL_FACE);
-		glEnable(GL_DEPTH);
 	}
 
 private:
-	GLuint program;
+	Shader* shader;
+	GLint worldLocation;
 
 	GLuint boxVAO, boxEBO;
 	int boxSize, boxIndexCount;
@@ -137,7 +132,7 @@ private:
 
 		//	Creating the VAO index, and binding it to create it's configuration.
 		glGenVertexArrays(1, &VAO);
-		glBindVertexArray(VAO);
+		RenderState::get().bindVertexArray(VAO);
 
 		//	Create buffer, bind it & assign vertices ot it.
 		GLuint VBO;
@@ -167,5 +162,7 @@ private:
 
 		glVertexAttribPointer(5, 3, GL_FLOAT, GL_TRUE, stride, (void*)(14 * sizeof(float)));
 		glEnableVertexAttribArray(5);
+
+		RenderState::get().bindVertexArray(0);
 	}
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/// <summary>
+/// Size and modification time of a source file, stored with the files built from it, so they can tell when they are out of date.
+/// Used by the mesh cache and the texture cooker.
+/// </summary>
+namespace sourcestamp
+{
+	/// <summary>
+	/// Gets the size and modification time of a file, both 0 if it doesn't exist.
+	/// </summary>
+	inline void get(const std::string& _source, uint64_t& _size, int64_t& _time)
+	{
+		struct stat status;
+		bool found	= stat(_source.c_str(), &status) == 0;
+
+		_size		= found ? (uint64_t)status.st_size : 0;
+		_time		= found ? (int64_t)status.st_mtime : 0;
+	}
+
+	/// <summary>
+	/// Whether something built from the source, with the given stamp, is still up to date with it.
+	/// A missing source counts as up to date, built files can be shipped without their sources.
+	/// </summary>
+	inline bool current(const std::string& _source, uint64_t _size, int64_t _time)
+	{
+		uint64_t size;
+		int64_t time;
+		get(_source, size, time);
+
+		return size == 0 || (size == _size && time == _time);
+	}
+};
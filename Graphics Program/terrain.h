@@ -1,5 +1,12 @@
 #pragma once
 
+#include <iostream>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -9,197 +16,783 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "util.h"
+#include "shader.h"
+#include "renderstate.h"
+#include "projection.h"
+#include "jobs.h"
+
+//	Size of a terrain chunk, in quads along each side. Has to be a power of two.
+#define TERRAIN_CHUNK_SIZE 64
+
+//	Amount of detail levels, each one using every other vertex of the previous one.
+#define TERRAIN_LOD_LEVELS 5
+
+//	Distance up to which chunks are drawn at full detail. Every doubling of it drops a level.
+#define TERRAIN_LOD_DISTANCE 400.0f
+
+//	Height vertices are displaced by, on top of the generated height. (Full white)
+#define TERRAIN_DISPLACEMENT 100.0f
+
+//	Deepest a ray descends the height bounds pyramid, enough for heightmaps up to 2^31 texels wide.
+#define TERRAIN_RAY_STACK 128
+
+//	Chunk sides, as used in the stitching masks. A set bit means the neighbour on that side is one level coarser.
+#define TERRAIN_SIDE_LEFT	1
+#define TERRAIN_SIDE_RIGHT	2
+#define TERRAIN_SIDE_BOTTOM	4
+#define TERRAIN_SIDE_TOP	8
+#define TERRAIN_SIDE_MASKS	16
+
+/// <summary>
+/// A square piece of the terrain, drawn or culled as a whole. Every chunk has its own block of vertices,
+/// so all of them can share the same index patterns.
+/// </summary>
+struct TerrainChunk
+{
+	glm::vec3 boundsMin, boundsMax;
+	GLint baseVertex;
+};
+
+/// <summary>
+/// Compact terrain vertex. The XZ position is implicit, the vertex shader derives it from the vertex' place in its chunk's block.
+/// </summary>
+struct TerrainVertex
+{
+	//	Heights normalized over the terrain's height range. The surface height leaves out the displacement, and drives the ground colors.
+	unsigned short height, surfaceHeight;
+
+	//	Octahedral encoded normal. The tangent along +X follows from it, as normalize(normal.y, -normal.x, 0).
+	signed char normal[2];
+
+	//	Keeps vertices 4 byte aligned.
+	unsigned char padding[2];
+};
+
+/// <summary>
+/// Range of the index buffer that draws a chunk at one level, stitched to its coarser neighbours.
+/// </summary>
+struct TerrainPattern
+{
+	GLsizei indexCount;
+	const void* offset;
+};
 
 class Terrain
 {
 public:
+	//	Amount of chunks and triangles drawn since the last reset, for profiling.
+	unsigned long long drawnChunks		= 0;
+	unsigned long long drawnTriangles	= 0;
+
+	//	Time it took to load the heightmap and generate the mesh on a worker thread, in milliseconds.
+	double generationMs = 0;
+
+	//	Set on the main thread once the mesh is uploaded. Until then nothing is drawn, and the queries can't be used.
+	bool loaded = false;
+
 	Terrain()
 	{
 		//	Creating the terrain shader.
-		util::createProgram(program, "shaders/terrainVertex.shader", "shaders/terrainFragment.shader");
-		glUseProgram(program);
-		glUniform1i(glGetUniformLocation(program, "diffuseTex"),	0);
-		glUniform1i(glGetUniformLocation(program, "normalTex"),		1);
-		glUniform1i(glGetUniformLocation(program, "dirt"),			2);
-		glUniform1i(glGetUniformLocation(program, "sand"),			3);
-		glUniform1i(glGetUniformLocation(program, "grass"),			4);
-		glUniform1i(glGetUniformLocation(program, "rock"),			5);
-		glUniform1i(glGetUniformLocation(program, "snow"),			6);
-
-		//	Generating the plane.
-		terrainVAO		= generatePlane("textures/heightmap.png", heightmapTexture, GL_RGBA, 4, 250.0f, 5.0f, terrainIndexCount, heightmapID);
-		heightNormalID	= util::loadTexture("textures/heightnormal.png");
+		shader			= new Shader("shaders/terrainVertex.shader", "shaders/terrainFragment.shader");
+		worldLocation	= shader->location("world");
+
+		RenderState::get().useProgram(shader->id);
+		glUniform1i(shader->location("dirt"),		2);
+		glUniform1i(shader->location("sand"),		3);
+		glUniform1i(shader->location("grass"),		4);
+		glUniform1i(shader->location("rock"),		5);
+		glUniform1i(shader->location("snow"),		6);
+
+		dirt	= util::loadTextureAsync("textures/dirt.jpg");
+		sand	= util::loadTextureAsync("textures/sand.jpg");
+		grass	= util::loadTextureAsync("textures/grass.png", 4);
+		rock	= util::loadTextureAsync("textures/rock.jpg");
+		snow	= util::loadTextureAsync("textures/snow.jpg");
+
+		//	Generating the plane on a worker thread, and uploading it on the main thread once it's done.
+		jobs::async([this]()
+		{
+			auto generationStart = std::chrono::high_resolution_clock::now();
+			bool generated	= generatePlane("textures/heightmap.png", heightmapTexture, 1, 250.0f, 5.0f);
+			generationMs	= std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - generationStart).count();
 
-		dirt	= util::loadTexture("textures/dirt.jpg");
-		sand	= util::loadTexture("textures/sand.jpg");
-		grass	= util::loadTexture("textures/grass.png", 4);
-		rock	= util::loadTexture("textures/rock.jpg");
-		snow	= util::loadTexture("textures/snow.jpg");
+			if (generated) jobs::onMainThread([this]() { upload(); });
+		});
 	}
 
-	void draw(glm::mat4 _view, glm::mat4 _projection, glm::vec3 _lightDirection, glm::vec3 _cameraPosition)
+	/// <summary>
+	/// Draws every chunk that is inside the view of the projection, at a level of detail based on its distance.
+	/// </summary>
+	void draw(const Projection* _projection)
 	{
+		if (!loaded) return;
+
+		selectLevels(_projection->position);
+
+		//	Gathering the visible chunks, so they can be drawn in a single call.
+		visibleCounts.clear();
+		visibleOffsets.clear();
+		visibleBaseVertices.clear();
+
+		for (int z = 0; z < chunksZ; z++)
+		{
+			for (int x = 0; x < chunksX; x++)
+			{
+				const TerrainChunk& chunk = chunks[z * chunksX + x];
+				if (!_projection->frustum.intersects(chunk.boundsMin, chunk.boundsMax)) continue;
+
+				int level = levelAt(x, z);
+
+				//	Sides that border a coarser chunk only use every other edge vertex, so both edges line up.
+				int mask = 0;
+				if (levelAt(x - 1, z) > level) mask |= TERRAIN_SIDE_LEFT;
+				if (levelAt(x + 1, z) > level) mask |= TERRAIN_SIDE_RIGHT;
+				if (levelAt(x, z - 1) > level) mask |= TERRAIN_SIDE_BOTTOM;
+				if (levelAt(x, z + 1) > level) mask |= TERRAIN_SIDE_TOP;
+
+				const TerrainPattern& pattern = patterns[level][mask];
+				visibleCounts.push_back(pattern.indexCount);
+				visibleOffsets.push_back(pattern.offset);
+				visibleBaseVertices.push_back(chunk.baseVertex);
+
+				drawnTriangles += pattern.indexCount / 3;
+			}
+		}
+
+		drawnChunks += visibleCounts.size();
+		if (visibleCounts.empty()) return;
+
 		//	Configuring options.
-		glEnable(GL_DEPTH);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
+		RenderState& state = RenderState::get();
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+		state.disable(GL_BLEND);
 
 		//	Setting current program.
-		glUseProgram(program);
+		state.useProgram(shader->id);
 
 		//	Creating world matrix.
 		glm::mat4 world = glm::mat4(1.0f);
 
-		//	Injecting projection data.
-		glUniformMatrix4fv(glGetUniformLocation(program, "world"),		1, GL_FALSE, glm::value_ptr(world));
-		glUniformMatrix4fv(glGetUniformLocation(program, "view"),		1, GL_FALSE, glm::value_ptr(_view));
-		glUniformMatrix4fv(glGetUniformLocation(program, "projection"),	1, GL_FALSE, glm::value_ptr(_projection));
-
-		//	Injecting relevant vectors.
-		// float t = glfwGetTime();
-		// lightDirection = glm::normalize(glm::vec3(glm::sin(t), -0.5f, glm::cos(t)));
-		glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(_lightDirection));
-		glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cameraPosition));
-
-		//	Injecting height textures.
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, heightmapID);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, heightNormalID);
+		//	Injecting world matrix. View, projection and vectors come from the FrameData block.
+		glUniformMatrix4fv(worldLocation, 1, GL_FALSE, glm::value_ptr(world));
 
 		//	Injecting ground textures.
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, dirt);
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, sand);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, grass);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, rock);
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, snow);
+		state.bindTexture(2, dirt);
+		state.bindTexture(3, sand);
+		state.bindTexture(4, grass);
+		state.bindTexture(5, rock);
+		state.bindTexture(6, snow);
 
 		//	Drawing!
-		glBindVertexArray(terrainVAO);
-		glDrawElements(GL_TRIANGLES, terrainIndexCount, GL_UNSIGNED_INT, 0);
+		state.bindVertexArray(terrainVAO);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, visibleCounts.data(), GL_UNSIGNED_SHORT, visibleOffsets.data(), (GLsizei)visibleCounts.size(), visibleBaseVertices.data());
+	}
+
+	//	The queries below can only be used once the terrain is loaded.
+
+	/// <summary>
+	/// Returns the size of the terrain in world space, along X and Z. It starts at the origin.
+	/// </summary>
+	glm::vec2 extent() const
+	{
+		return glm::vec2((heightmapWidth - 1) * xzScale, (heightmapHeight - 1) * xzScale);
+	}
+
+	/// <summary>
+	/// Returns the height of the full detail surface at a world position, interpolated over the same triangles the mesh uses.
+	/// Positions outside of the terrain are clamped to its edge.
+	/// </summary>
+	float heightAt(float _x, float _z) const
+	{
+		int x, z;
+		float fx, fz;
+		cellAt(_x, _z, x, z, fx, fz);
+
+		float h00 = heights[z * heightmapWidth + x],		h10 = heights[z * heightmapWidth + x + 1];
+		float h01 = heights[(z + 1) * heightmapWidth + x],	h11 = heights[(z + 1) * heightmapWidth + x + 1];
+
+		//	Quads are split along the diagonal from (0, 0) to (1, 1).
+		if (fx >= fz)	return h00 + fx * (h10 - h00) + fz * (h11 - h10);
+		else			return h00 + fz * (h01 - h00) + fx * (h11 - h01);
+	}
+
+	/// <summary>
+	/// Returns the shading normal at a world position, bilinearly interpolated between the baked vertex normals.
+	/// </summary>
+	glm::vec3 normalAt(float _x, float _z) const
+	{
+		int x, z;
+		float fx, fz;
+		cellAt(_x, _z, x, z, fx, fz);
+
+		const glm::vec3* row	= &normals[z * heightmapWidth + x];
+		const glm::vec3* rowTop	= row + heightmapWidth;
+
+		glm::vec3 bottom	= glm::mix(row[0], row[1], fx);
+		glm::vec3 top		= glm::mix(rowTop[0], rowTop[1], fx);
+
+		return glm::normalize(glm::mix(bottom, top, fz));
+	}
+
+	/// <summary>
+	/// Intersects a ray with the full detail surface. Descends a pyramid of min/max height bounds front to back,
+	/// so only the cells near the ray are tested against their triangles.
+	/// </summary>
+	/// <param name="_direction">Doesn't have to be normalized, distances are in multiples of it.</param>
+	/// <param name="_distance">Set to the distance of the nearest hit.</param>
+	/// <returns>Whether the ray hits the terrain within _maxDistance.</returns>
+	bool raycast(glm::vec3 _origin, glm::vec3 _direction, float _maxDistance, float& _distance) const
+	{
+		struct Node { int level, x, z; float enter; };
+
+		Node stack[TERRAIN_RAY_STACK];
+		int stackSize = 0;
+
+		float best = _maxDistance;
+		int top = (int)heightBounds.size() - 1;
+
+		float enter;
+		if (!rayNode(_origin, _direction, top, 0, 0, best, enter)) return false;
+		stack[stackSize++] = { top, 0, 0, enter };
+
+		while (stackSize > 0)
+		{
+			Node node = stack[--stackSize];
+
+			//	Something closer was hit since this node was pushed.
+			if (node.enter > best) continue;
+
+			if (node.level == 0)
+			{
+				glm::vec3 p00 = gridPoint(node.x, node.z),		p10 = gridPoint(node.x + 1, node.z);
+				glm::vec3 p01 = gridPoint(node.x, node.z + 1),	p11 = gridPoint(node.x + 1, node.z + 1);
+
+				rayTriangle(_origin, _direction, p00, p01, p11, best);
+				rayTriangle(_origin, _direction, p00, p11, p10, best);
+				continue;
+			}
+
+			//	Pushing the children that are hit, the nearest last so it's visited first.
+			Node children[4];
+			int childCount = 0;
+
+			for (int i = 0; i < 4; i++)
+			{
+				int childX = node.x * 2 + (i & 1);
+				int childZ = node.z * 2 + (i >> 1);
+
+				if (childX >= boundsSize[node.level - 1].x || childZ >= boundsSize[node.level - 1].y) continue;
+				if (!rayNode(_origin, _direction, node.level - 1, childX, childZ, best, enter)) continue;
+
+				children[childCount++] = { node.level - 1, childX, childZ, enter };
+			}
+
+			std::sort(children, children + childCount, [](const Node& a, const Node& b) { return a.enter > b.enter; });
+			for (int i = 0; i < childCount; i++) stack[stackSize++] = children[i];
+		}
+
+		if (best >= _maxDistance) return false;
+
+		_distance = best;
+		return true;
 	}
 
 private:
-	GLuint program;
+	Shader* shader;
+	GLint worldLocation;
 
-	GLuint terrainVAO, terrainIndexCount, heightmapID, heightNormalID;
+	GLuint terrainVAO;
+
+	//	CPU side heightmap, one byte per texel.
 	unsigned char* heightmapTexture;
+	int heightmapWidth = 0, heightmapHeight = 0;
+
+	//	Generated mesh, kept until it's uploaded.
+	std::vector<TerrainVertex> planeVertices;
+	std::vector<unsigned short> planeIndices;
+
+	//	World space height of every heightmap texel, displacement included.
+	std::vector<float> heights;
+
+	//	Shading normal of every heightmap texel, baked from the heights.
+	std::vector<glm::vec3> normals;
+
+	//	Min/max height of every cell, and of every 2x2 block of the level below it, up to a single root. With the size of each level.
+	std::vector<std::vector<glm::vec2>> heightBounds;
+	std::vector<glm::ivec2> boundsSize;
+
+	//	Distance between vertices, and the height a normalized height of 1 maps to.
+	float xzScale = 0, heightRange = 0;
 	GLuint dirt, sand, grass, rock, snow;
 
+	//	Chunk grid, and the level each chunk is drawn at in the current pass.
+	int chunksX = 0, chunksZ = 0;
+	std::vector<TerrainChunk> chunks;
+	std::vector<int> levels;
+
+	TerrainPattern patterns[TERRAIN_LOD_LEVELS][TERRAIN_SIDE_MASKS];
+
+	std::vector<GLsizei> visibleCounts;
+	std::vector<const void*> visibleOffsets;
+	std::vector<GLint> visibleBaseVertices;
+
 	/// <summary>
-	/// Function that creates a plane
+	/// Returns the level of a chunk, or -1 outside of the grid.
 	/// </summary>
-	unsigned int generatePlane(const char* heightmap, unsigned char*& data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID)
+	int levelAt(int x, int z) const
 	{
-		int width, height, channels;
-		data = nullptr;
-		if (heightmap != nullptr)
+		if (x < 0 || z < 0 || x >= chunksX || z >= chunksZ) return -1;
+		return levels[z * chunksX + x];
+	}
+
+	/// <summary>
+	/// Picks the level of every chunk from its distance to the viewer, then limits neighbours to one level apart
+	/// so the stitching patterns can close every gap.
+	/// </summary>
+	void selectLevels(glm::vec3 _position)
+	{
+		for (size_t i = 0; i < chunks.size(); i++)
 		{
-			data = stbi_load(heightmap, &width, &height, &channels, comp);
-			if (data)
-			{
-				glGenTextures(1, &heightmapID);
-				glBindTexture(GL_TEXTURE_2D, heightmapID);
+			glm::vec3 closest	= glm::clamp(_position, chunks[i].boundsMin, chunks[i].boundsMax);
+			float distance		= glm::length(_position - closest);
 
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			int level = 0;
+			if (distance >= TERRAIN_LOD_DISTANCE) level = (int)glm::log2(distance / TERRAIN_LOD_DISTANCE) + 1;
 
-				glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-				glGenerateMipmap(GL_TEXTURE_2D);
-				glBindTexture(GL_TEXTURE_2D, 0);
+			levels[i] = std::min(level, TERRAIN_LOD_LEVELS - 1);
+		}
+
+		//	Lowering chunks that are too coarse compared to a neighbour, until nothing changes.
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (int z = 0; z < chunksZ; z++)
+			{
+				for (int x = 0; x < chunksX; x++)
+				{
+					int& level = levels[z * chunksX + x];
+					int limit = level;
+
+					if (x > 0)				limit = std::min(limit, levelAt(x - 1, z) + 1);
+					if (x < chunksX - 1)	limit = std::min(limit, levelAt(x + 1, z) + 1);
+					if (z > 0)				limit = std::min(limit, levelAt(x, z - 1) + 1);
+					if (z < chunksZ - 1)	limit = std::min(limit, levelAt(x, z + 1) + 1);
+
+					if (limit < level)
+					{
+						level	= limit;
+						changed	= true;
+					}
+				}
 			}
 		}
+	}
 
-		int stride = 8;
-		float* vertices = new float[(width * height) * stride];
-		unsigned int* indices = new unsigned int[(width - 1) * (height - 1) * 6];
+	/// <summary>
+	/// Creates the buffers of the generated plane, and describes the grid to the shader. Runs on the main thread.
+	/// </summary>
+	void upload()
+	{
+		terrainVAO = uploadPlane();
 
-		int index = 0;
-		for (int i = 0; i < (width * height); i++)
+		//	Describing the grid, so the vertex shader can rebuild positions from it.
+		RenderState::get().useProgram(shader->id);
+		glUniform2i(shader->location("heightmapSize"),	heightmapWidth, heightmapHeight);
+		glUniform1i(shader->location("chunkSize"),		TERRAIN_CHUNK_SIZE);
+		glUniform1i(shader->location("chunkColumns"),	chunksX);
+		glUniform1f(shader->location("xzScale"),		xzScale);
+		glUniform1f(shader->location("heightRange"),	heightRange);
+
+		loaded = true;
+	}
+
+	/// <summary>
+	/// Function that creates a plane. Only does CPU work, so it can run on a worker thread.
+	/// </summary>
+	bool generatePlane(const char* heightmap, unsigned char*& data, int comp, float hScale, float _xzScale)
+	{
+		int width = 0, height = 0, channels;
+		data = stbi_load(heightmap, &width, &height, &channels, comp);
+		if (data == nullptr)
 		{
-			// Calculate x/z values
-			int x = i % width;
-			int z = i / width;
+			std::cout << "Error loading heightmap: " << heightmap << "." << std::endl;
+			return false;
+		}
 
-			float texHeight = (float)data[i * comp];
+		heightmapWidth	= width;
+		heightmapHeight	= height;
+		xzScale			= _xzScale;
+		heightRange		= hScale + TERRAIN_DISPLACEMENT;
 
-			// Set position
-			vertices[index++] = x * xzScale;
-			vertices[index++] = (texHeight / 255.0f) * hScale;
-			vertices[index++] = z * xzScale;
+		// Chunks cover the heightmap, the ones along the far edges are padded with degenerate quads
+		chunksX = (width - 2) / TERRAIN_CHUNK_SIZE + 1;
+		chunksZ = (height - 2) / TERRAIN_CHUNK_SIZE + 1;
+		chunks.resize(chunksX * chunksZ);
+		levels.resize(chunks.size(), 0);
 
-			// Set normal
-			vertices[index++] = 0;
-			vertices[index++] = 1;
-			vertices[index++] = 0;
+		int chunkVertices = (TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1);
+		planeVertices.resize(chunks.size() * chunkVertices);
 
-			// Set uv
-			vertices[index++] = x / (float)width;
-			vertices[index++] = z / (float)height;
-		}
+		// World heights of every texel first, the normals need their neighbours
+		heights.resize(width * height);
+		jobs::parallelFor(height, [&](int z)
+		{
+			for (int x = 0; x < width; x++)
+				heights[z * width + x] = (texel(data, x, z, comp) / 255.0f) * hScale + displacement(data, x, z, comp);
+		});
 
-		// OPTIONAL TODO: Calculate normal
-		// TODO: Set normal
+		buildNormals();
+		buildHeightBounds();
 
-		index = 0;
-		for (int i = 0; i < (width - 1) * (height - 1); i++)
+		// Chunks are independent, so they are generated on every core
+		jobs::parallelFor((int)chunks.size(), [&](int chunkIndex)
 		{
-			// Calculate x/z values
-			int x = i % (width - 1);
-			int z = i / (width - 1);
+			TerrainChunk& chunk = chunks[chunkIndex];
+			chunk.baseVertex = chunkIndex * chunkVertices;
+
+			int startX = (chunkIndex % chunksX) * TERRAIN_CHUNK_SIZE;
+			int startZ = (chunkIndex / chunksX) * TERRAIN_CHUNK_SIZE;
+
+			float minHeight = heightRange, maxHeight = 0;
+			for (int i = 0; i < chunkVertices; i++)
+			{
+				// Calculate x/z values, clamped to the heightmap
+				int x = std::min(startX + i % (TERRAIN_CHUNK_SIZE + 1), width - 1);
+				int z = std::min(startZ + i / (TERRAIN_CHUNK_SIZE + 1), height - 1);
+
+				float surface		= (texel(data, x, z, comp) / 255.0f) * hScale;
+				float worldHeight	= heights[z * width + x];
+
+				TerrainVertex& vertex = planeVertices[chunk.baseVertex + i];
+				vertex.height			= quantizeHeight(worldHeight);
+				vertex.surfaceHeight	= quantizeHeight(surface);
+				vertex.padding[0]		= vertex.padding[1] = 0;
+				encodeNormal(normals[z * width + x], vertex.normal);
 
-			int vertex = z * width + x;
+				minHeight = std::min(minHeight, worldHeight);
+				maxHeight = std::max(maxHeight, worldHeight);
+			}
+
+			// Bounds, padded by a quantization step
+			float epsilon = heightRange / 65535.0f;
+			chunk.boundsMin = glm::vec3(startX * xzScale, minHeight - epsilon, startZ * xzScale);
+			chunk.boundsMax = glm::vec3(std::min(startX + TERRAIN_CHUNK_SIZE, width - 1) * xzScale, maxHeight + epsilon, std::min(startZ + TERRAIN_CHUNK_SIZE, height - 1) * xzScale);
+		});
 
-			indices[index++] = vertex;
-			indices[index++] = vertex + width;
-			indices[index++] = vertex + width + 1;
+		// Index patterns for every level and stitching mask, relative to a chunk's first vertex. Generated in parallel, then packed into one buffer
+		std::vector<std::vector<unsigned short>> patternIndices(TERRAIN_LOD_LEVELS * TERRAIN_SIDE_MASKS);
+		jobs::parallelFor((int)patternIndices.size(), [&](int pattern)
+		{
+			generatePattern(patternIndices[pattern], 1 << (pattern / TERRAIN_SIDE_MASKS), pattern % TERRAIN_SIDE_MASKS);
+		});
 
-			indices[index++] = vertex;
-			indices[index++] = vertex + width + 1;
-			indices[index++] = vertex + 1;
+		planeIndices.clear();
+		for (size_t pattern = 0; pattern < patternIndices.size(); pattern++)
+		{
+			TerrainPattern& range = patterns[pattern / TERRAIN_SIDE_MASKS][pattern % TERRAIN_SIDE_MASKS];
+			range.offset		= (const void*)(planeIndices.size() * sizeof(unsigned short));
+			range.indexCount	= (GLsizei)patternIndices[pattern].size();
+
+			planeIndices.insert(planeIndices.end(), patternIndices[pattern].begin(), patternIndices[pattern].end());
 		}
 
-		unsigned int vertSize = (width * height) * stride * sizeof(float);
-		indexCount = ((width - 1) * (height - 1) * 6);
+		// stbi_image_free(data);
+
+		return true;
+	}
 
+	/// <summary>
+	/// Uploads the generated plane and frees the CPU copy of it.
+	/// </summary>
+	unsigned int uploadPlane()
+	{
 		unsigned int VAO, VBO, EBO;
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
-		glBindVertexArray(VAO);
+		RenderState::get().bindVertexArray(VAO);
 
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertSize, vertices, GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, planeVertices.size() * sizeof(TerrainVertex), planeVertices.data(), GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, planeIndices.size() * sizeof(unsigned short), planeIndices.data(), GL_STATIC_DRAW);
 
 		// vertex information!
-		// position
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, 0);
+		// height
+		glVertexAttribPointer(0, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, height));
 		glEnableVertexAttribArray(0);
-		// normal
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 3));
+		// surface height
+		glVertexAttribPointer(1, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, surfaceHeight));
 		glEnableVertexAttribArray(1);
-		// uv
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 6));
+		// normal
+		glVertexAttribPointer(2, 2, GL_BYTE, GL_TRUE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, normal));
 		glEnableVertexAttribArray(2);
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		glBindVertexArray(0);
+		RenderState::get().bindVertexArray(0);
 
-		delete[] vertices;
-		delete[] indices;
-
-		// stbi_image_free(data);
+		std::vector<TerrainVertex>().swap(planeVertices);
+		std::vector<unsigned short>().swap(planeIndices);
 
 		return VAO;
 	}
+
+	/// <summary>
+	/// Returns a heightmap texel, wrapping around the edges like the texture sampler used to.
+	/// </summary>
+	float texel(const unsigned char* data, int x, int z, int comp) const
+	{
+		x = (x + heightmapWidth) % heightmapWidth;
+		z = (z + heightmapHeight) % heightmapHeight;
+
+		return (float)data[(z * heightmapWidth + x) * comp];
+	}
+
+	/// <summary>
+	/// The displacement the vertex shader used to add, a filtered heightmap sample at the vertex' uv.
+	/// Sampling at x / width lands between two texels on both axes, so it's the average of four.
+	/// </summary>
+	float displacement(const unsigned char* data, int x, int z, int comp) const
+	{
+		float sum = texel(data, x - 1, z - 1, comp) + texel(data, x, z - 1, comp) + texel(data, x - 1, z, comp) + texel(data, x, z, comp);
+		return (sum / (4.0f * 255.0f)) * TERRAIN_DISPLACEMENT;
+	}
+
+	/// <summary>
+	/// Bakes the normal of every texel, from the 3x3 Sobel gradient of the world heights. Clamps at the edges.
+	/// </summary>
+	void buildNormals()
+	{
+		normals.resize(heights.size());
+		jobs::parallelFor(heightmapHeight, [&](int z)
+		{
+			int bottom	= std::max(z - 1, 0),	top = std::min(z + 1, heightmapHeight - 1);
+
+			const float* rowBottom	= &heights[bottom * heightmapWidth];
+			const float* row		= &heights[z * heightmapWidth];
+			const float* rowTop		= &heights[top * heightmapWidth];
+
+			//	The kernel weights add up to 4 on each side, over two texels, or one where the edge clamps it.
+			float scaleZ = 1.0f / (4.0f * std::max(top - bottom, 1) * xzScale);
+
+			for (int x = 0; x < heightmapWidth; x++)
+			{
+				int left = std::max(x - 1, 0), right = std::min(x + 1, heightmapWidth - 1);
+
+				float dx = (rowBottom[right] + 2.0f * row[right] + rowTop[right]) - (rowBottom[left] + 2.0f * row[left] + rowTop[left]);
+				float dz = (rowTop[left] + 2.0f * rowTop[x] + rowTop[right]) - (rowBottom[left] + 2.0f * rowBottom[x] + rowBottom[right]);
+
+				float scaleX = 1.0f / (4.0f * std::max(right - left, 1) * xzScale);
+				normals[z * heightmapWidth + x] = glm::normalize(glm::vec3(-dx * scaleX, 1.0f, -dz * scaleZ));
+			}
+		});
+	}
+
+	/// <summary>
+	/// Builds the min/max pyramid the raycasts descend.
+	/// </summary>
+	void buildHeightBounds()
+	{
+		heightBounds.clear();
+		boundsSize.clear();
+
+		//	Level 0 holds the cells between texels.
+		glm::ivec2 size(heightmapWidth - 1, heightmapHeight - 1);
+		heightBounds.push_back(std::vector<glm::vec2>(size.x * size.y));
+		boundsSize.push_back(size);
+
+		jobs::parallelFor(size.y, [&](int z)
+		{
+			for (int x = 0; x < size.x; x++)
+			{
+				float a = heights[z * heightmapWidth + x],			b = heights[z * heightmapWidth + x + 1];
+				float c = heights[(z + 1) * heightmapWidth + x],	d = heights[(z + 1) * heightmapWidth + x + 1];
+
+				heightBounds[0][z * size.x + x] = glm::vec2(std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d)));
+			}
+		});
+
+		while (size.x > 1 || size.y > 1)
+		{
+			const std::vector<glm::vec2>& below = heightBounds.back();
+			glm::ivec2 belowSize = size;
+
+			size = glm::ivec2((size.x + 1) / 2, (size.y + 1) / 2);
+			std::vector<glm::vec2> level(size.x * size.y, glm::vec2(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()));
+
+			for (int z = 0; z < belowSize.y; z++)
+			{
+				for (int x = 0; x < belowSize.x; x++)
+				{
+					glm::vec2& bounds = level[(z / 2) * size.x + x / 2];
+					bounds.x = std::min(bounds.x, below[z * belowSize.x + x].x);
+					bounds.y = std::max(bounds.y, below[z * belowSize.x + x].y);
+				}
+			}
+
+			heightBounds.push_back(level);
+			boundsSize.push_back(size);
+		}
+	}
+
+	/// <summary>
+	/// Finds the cell a world position falls in, clamped to the terrain, and the position within it.
+	/// </summary>
+	void cellAt(float _x, float _z, int& x, int& z, float& fx, float& fz) const
+	{
+		float gridX = glm::clamp(_x / xzScale, 0.0f, (float)(heightmapWidth - 1));
+		float gridZ = glm::clamp(_z / xzScale, 0.0f, (float)(heightmapHeight - 1));
+
+		x = std::min((int)gridX, heightmapWidth - 2);
+		z = std::min((int)gridZ, heightmapHeight - 2);
+
+		fx = gridX - x;
+		fz = gridZ - z;
+	}
+
+	glm::vec3 gridPoint(int x, int z) const
+	{
+		return glm::vec3(x * xzScale, heights[z * heightmapWidth + x], z * xzScale);
+	}
+
+	/// <summary>
+	/// Slab test of a ray against the bounds of a pyramid node.
+	/// </summary>
+	/// <param name="enter">Set to the distance the ray enters the box at, at least 0.</param>
+	/// <returns>Whether the ray passes through the box before _maxDistance.</returns>
+	bool rayNode(glm::vec3 _origin, glm::vec3 _direction, int _level, int _x, int _z, float _maxDistance, float& enter) const
+	{
+		int cells = 1 << _level;
+		glm::vec2 bounds = heightBounds[_level][_z * boundsSize[_level].x + _x];
+
+		glm::vec3 boxMin(_x * cells * xzScale, bounds.x, _z * cells * xzScale);
+		glm::vec3 boxMax(std::min((_x + 1) * cells, heightmapWidth - 1) * xzScale, bounds.y, std::min((_z + 1) * cells, heightmapHeight - 1) * xzScale);
+
+		float entry = 0.0f, exit = _maxDistance;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (_direction[axis] == 0.0f)
+			{
+				//	Parallel to the slab, so either always or never inside it.
+				if (_origin[axis] < boxMin[axis] || _origin[axis] > boxMax[axis]) return false;
+				continue;
+			}
+
+			float inverse	= 1.0f / _direction[axis];
+			float t0		= (boxMin[axis] - _origin[axis]) * inverse;
+			float t1		= (boxMax[axis] - _origin[axis]) * inverse;
+			if (t0 > t1) std::swap(t0, t1);
+
+			entry	= std::max(entry, t0);
+			exit	= std::min(exit, t1);
+			if (entry > exit) return false;
+		}
+
+		enter = entry;
+		return true;
+	}
+
+	/// <summary>
+	/// Moller-Trumbore ray/triangle test, lowering _nearest if the triangle is hit closer than it.
+	/// </summary>
+	static void rayTriangle(glm::vec3 _origin, glm::vec3 _direction, glm::vec3 a, glm::vec3 b, glm::vec3 c, float& _nearest)
+	{
+		glm::vec3 edge1 = b - a, edge2 = c - a;
+		glm::vec3 p = glm::cross(_direction, edge2);
+
+		float determinant = glm::dot(edge1, p);
+		if (glm::abs(determinant) < 1e-12f) return;
+
+		float inverse = 1.0f / determinant;
+		glm::vec3 offset = _origin - a;
+
+		float u = glm::dot(offset, p) * inverse;
+		if (u < 0.0f || u > 1.0f) return;
+
+		glm::vec3 q = glm::cross(offset, edge1);
+		float v = glm::dot(_direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f) return;
+
+		float t = glm::dot(edge2, q) * inverse;
+		if (t >= 0.0f && t < _nearest) _nearest = t;
+	}
+
+	unsigned short quantizeHeight(float _height) const
+	{
+		return (unsigned short)glm::clamp(glm::round(_height / heightRange * 65535.0f), 0.0f, 65535.0f);
+	}
+
+	/// <summary>
+	/// Octahedral encodes a unit vector into two signed bytes.
+	/// </summary>
+	static void encodeNormal(glm::vec3 _normal, signed char* _output)
+	{
+		_normal /= glm::abs(_normal.x) + glm::abs(_normal.y) + glm::abs(_normal.z);
+
+		glm::vec2 encoded(_normal.x, _normal.y);
+		if (_normal.z < 0)
+		{
+			encoded.x = (1.0f - glm::abs(_normal.y)) * (_normal.x >= 0 ? 1.0f : -1.0f);
+			encoded.y = (1.0f - glm::abs(_normal.x)) * (_normal.y >= 0 ? 1.0f : -1.0f);
+		}
+
+		_output[0] = (signed char)glm::round(glm::clamp(encoded.x, -1.0f, 1.0f) * 127.0f);
+		_output[1] = (signed char)glm::round(glm::clamp(encoded.y, -1.0f, 1.0f) * 127.0f);
+	}
+
+	/// <summary>
+	/// Appends the triangles of a chunk that uses every step-th vertex. On the sides in the mask the odd edge vertices
+	/// are snapped onto the previous even one, which turns those quads into fans matching the coarser neighbour.
+	/// </summary>
+	void generatePattern(std::vector<unsigned short>& indices, int step, int mask)
+	{
+		int coarseStep = step * 2;
+
+		for (int z = 0; z < TERRAIN_CHUNK_SIZE; z += step)
+		{
+			for (int x = 0; x < TERRAIN_CHUNK_SIZE; x += step)
+			{
+				unsigned short corners[4] =
+				{
+					chunkVertex(x, z, step, coarseStep, mask),
+					chunkVertex(x, z + step, step, coarseStep, mask),
+					chunkVertex(x + step, z + step, step, coarseStep, mask),
+					chunkVertex(x + step, z, step, coarseStep, mask)
+				};
+
+				addTriangle(indices, corners[0], corners[1], corners[2]);
+				addTriangle(indices, corners[0], corners[2], corners[3]);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the index of a vertex within a chunk, snapped along the stitched sides.
+	/// </summary>
+	unsigned short chunkVertex(int x, int z, int step, int coarseStep, int mask) const
+	{
+		if ((mask & TERRAIN_SIDE_LEFT)		&& x == 0					&& z % coarseStep) z -= step;
+		if ((mask & TERRAIN_SIDE_RIGHT)		&& x == TERRAIN_CHUNK_SIZE	&& z % coarseStep) z -= step;
+		if ((mask & TERRAIN_SIDE_BOTTOM)	&& z == 0					&& x % coarseStep) x -= step;
+		if ((mask & TERRAIN_SIDE_TOP)		&& z == TERRAIN_CHUNK_SIZE	&& x % coarseStep) x -= step;
+
+		return (unsigned short)(z * (TERRAIN_CHUNK_SIZE + 1) + x);
+	}
+
+	/// <summary>
+	/// Appends a triangle, unless snapping collapsed it.
+	/// </summary>
+	void addTriangle(std::vector<unsigned short>& indices, unsigned short a, unsigned short b, unsigned short c) const
+	{
+		if (a == b || b == c || a == c) return;
+
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	}
 };
\ No newline at end of file
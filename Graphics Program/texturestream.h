@@ -0,0 +1,354 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include "renderstate.h"
+#include "mipmap.h"
+#include "dds.h"
+
+//	S3TC isn't core, so a GL 3.3 loader might not define these.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83F3
+#endif
+
+//	Amount of bytes uploaded per frame at most, so big textures are spread over several frames instead of stalling one.
+#define TEXTURE_STREAM_BUDGET (1 << 20)
+
+/// <summary>
+/// Decoded or cooked texture with its whole mip chain, waiting to be uploaded.
+/// </summary>
+struct StreamedTexture
+{
+	GLuint id		= 0;
+	int channels	= 0;
+
+	//	Set for block compressed textures, whose rows are rows of 4x4 blocks.
+	GLenum compressedFormat	= 0;
+	int blockSize			= 0;
+
+	//	Mip levels, largest first.
+	std::vector<int> widths, heights;
+	std::vector<std::vector<unsigned char>> levels;
+
+	//	Upload progress. Levels go from smallest to largest, so the texture sharpens as it streams in.
+	int level		= -1;
+	int row			= 0;
+	bool allocated	= false;
+
+	int rowCount(int _level) const
+	{
+		return blockSize > 0 ? (heights[_level] + 3) / 4 : heights[_level];
+	}
+
+	size_t rowSize(int _level) const
+	{
+		return blockSize > 0 ? (size_t)((widths[_level] + 3) / 4) * blockSize : (size_t)widths[_level] * channels;
+	}
+};
+
+/// <summary>
+/// Streams textures to the GPU through a pixel unpack buffer, a bounded amount of rows per frame.
+/// The smallest mip levels go first and the texture's base level is lowered as each level completes,
+/// so a texture is usable right away and there's no glGenerateMipmap stall. Cooked textures stream the same way, block row by block row.
+/// </summary>
+class TextureStream
+{
+public:
+	//	Profiling counters.
+	unsigned long long uploadedBytes	= 0;
+	unsigned int compressedTextures		= 0;
+
+	//	Whether BC1 and BC3 can be used. BC4 is core, so it always can.
+	bool s3tc = false;
+
+	static TextureStream& get()
+	{
+		static TextureStream stream;
+		return stream;
+	}
+
+	/// <summary>
+	/// Builds the mip chain of decoded pixels with a box filter. Only does CPU work, so it can run on a worker thread.
+	/// </summary>
+	static StreamedTexture prepare(GLuint _id, const unsigned char* _data, int _width, int _height, int _channels)
+	{
+		StreamedTexture texture;
+		texture.id			= _id;
+		texture.channels	= _channels;
+
+		texture.widths.push_back(_width);
+		texture.heights.push_back(_height);
+		texture.levels.emplace_back(_data, _data + (size_t)_width * _height * _channels);
+
+		while (texture.widths.back() > 1 || texture.heights.back() > 1)
+		{
+			int width, height;
+			std::vector<unsigned char> level = mipmap::downsample(texture.levels.back().data(), texture.widths.back(), texture.heights.back(), _channels, width, height);
+
+			texture.widths.push_back(width);
+			texture.heights.push_back(height);
+			texture.levels.push_back(std::move(level));
+		}
+
+		texture.level = (int)texture.levels.size() - 1;
+		return texture;
+	}
+
+	/// <summary>
+	/// Wraps a cooked image, whose mip chain is already built. Can run on a worker thread.
+	/// </summary>
+	static StreamedTexture prepare(GLuint _id, dds::Image&& _image)
+	{
+		StreamedTexture texture;
+		texture.id					= _id;
+		texture.channels			= _image.format == dds::FORMAT_BC4 ? 1 : 4;
+		texture.compressedFormat	= compressedFormatOf(_image.format);
+		texture.blockSize			= dds::blockSize(_image.format);
+		texture.levels				= std::move(_image.levels);
+
+		int width = _image.width, height = _image.height;
+		for (size_t i = 0; i < texture.levels.size(); i++)
+		{
+			texture.widths.push_back(width);
+			texture.heights.push_back(height);
+
+			width	= std::max(width / 2, 1);
+			height	= std::max(height / 2, 1);
+		}
+
+		texture.level = (int)texture.levels.size() - 1;
+		return texture;
+	}
+
+	/// <summary>
+	/// Returns the GL format of a cooked format.
+	/// </summary>
+	static GLenum compressedFormatOf(dds::Format _format)
+	{
+		switch (_format)
+		{
+			case dds::FORMAT_BC3:	return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			case dds::FORMAT_BC4:	return GL_COMPRESSED_RED_RGTC1;
+			default:				return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		}
+	}
+
+	/// <summary>
+	/// Returns whether a cooked image can be used, or the source image should be decoded instead.
+	/// </summary>
+	bool supports(const dds::Image& _image) const
+	{
+		return _image.format == dds::FORMAT_BC4 || s3tc;
+	}
+
+	/// <summary>
+	/// Queues a prepared texture. Can be called from any thread, the upload itself happens in update.
+	/// </summary>
+	void add(StreamedTexture&& _texture)
+	{
+		std::lock_guard<std::mutex> lock(incomingMutex);
+		if (_texture.blockSize > 0) compressedTextures++;
+		incoming.push_back(std::move(_texture));
+	}
+
+	/// <summary>
+	/// Uploads up to _budget bytes of the queued textures, in the order they were added. Call this from the main thread, once per frame.
+	/// </summary>
+	/// <returns>False if the staging buffer couldn't be mapped, in which case nothing was uploaded and the rows are tried again next call.</returns>
+	bool update(size_t _budget = TEXTURE_STREAM_BUDGET)
+	{
+		{
+			std::lock_guard<std::mutex> lock(incomingMutex);
+			for (StreamedTexture& texture : incoming) textures.push_back(std::move(texture));
+			incoming.clear();
+		}
+
+		if (textures.empty()) return true;
+
+		//	Cutting the next rows into slices that fit the budget. Every call makes some progress, even if a single row is too big.
+		slices.clear();
+		size_t used = 0;
+
+		for (StreamedTexture& texture : textures)
+		{
+			while (texture.level >= 0 && used < _budget)
+			{
+				if (!texture.allocated) allocate(texture);
+
+				int rowCount	= texture.rowCount(texture.level);
+				size_t rowSize	= texture.rowSize(texture.level);
+
+				int rows = (int)std::min((size_t)(rowCount - texture.row), std::max((_budget - used) / rowSize, (size_t)1));
+
+				Slice slice = { &texture, texture.level, texture.row, rows, used, texture.row + rows == rowCount };
+				slices.push_back(slice);
+
+				used		+= rows * rowSize;
+				texture.row	+= rows;
+
+				if (slice.completes)
+				{
+					texture.level--;
+					texture.row = 0;
+				}
+			}
+
+			if (used >= _budget) break;
+		}
+
+		//	Orphaning last frame's storage, so we don't wait on uploads that are still reading it.
+		if (buffer == 0) glGenBuffers(1, &buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, used, NULL, GL_STREAM_DRAW);
+
+		unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, used, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped != NULL)
+		{
+			for (const Slice& slice : slices)
+			{
+				size_t rowSize = slice.texture->rowSize(slice.level);
+				memcpy(mapped + slice.offset, slice.texture->levels[slice.level].data() + slice.row * rowSize, slice.rows * rowSize);
+			}
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			//	Rows of three channel textures aren't always 4 byte aligned.
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+			for (const Slice& slice : slices)
+			{
+				StreamedTexture& texture = *slice.texture;
+				RenderState::get().editTexture(texture.id);
+
+				int width = texture.widths[slice.level], height = texture.heights[slice.level];
+
+				if (texture.blockSize > 0)
+				{
+					//	Block rows are 4 pixels high, except for the last one of levels that aren't a multiple of 4.
+					int y = slice.row * 4;
+					glCompressedTexSubImage2D(GL_TEXTURE_2D, slice.level, 0, y, width, std::min(slice.rows * 4, height - y), texture.compressedFormat,
+						(GLsizei)(slice.rows * texture.rowSize(slice.level)), (const void*)slice.offset);
+				}
+				else
+				{
+					glTexSubImage2D(GL_TEXTURE_2D, slice.level, 0, slice.row, width, slice.rows, formatOf(texture.channels), GL_UNSIGNED_BYTE, (const void*)slice.offset);
+				}
+
+				//	Showing the finished level, and freeing its pixels.
+				if (slice.completes)
+				{
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, slice.level);
+					std::vector<unsigned char>().swap(texture.levels[slice.level]);
+				}
+			}
+
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			uploadedBytes += used;
+		}
+		else
+		{
+			//	Nothing was uploaded, so every texture goes back to where its first slice started.
+			for (auto slice = slices.rbegin(); slice != slices.rend(); ++slice)
+			{
+				slice->texture->level	= slice->level;
+				slice->texture->row		= slice->row;
+			}
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		//	Textures finish in the order they were added.
+		while (!textures.empty() && textures.front().level < 0) textures.pop_front();
+
+		return mapped != NULL;
+	}
+
+	/// <summary>
+	/// Uploads everything that's queued, ignoring the budget. Gives up if the staging buffer can't be mapped, rather than trying forever.
+	/// </summary>
+	void flush()
+	{
+		while (busy() && update(SIZE_MAX));
+	}
+
+	/// <summary>
+	/// Returns true while any texture is still queued.
+	/// </summary>
+	bool busy()
+	{
+		std::lock_guard<std::mutex> lock(incomingMutex);
+		return !textures.empty() || !incoming.empty();
+	}
+
+private:
+	struct Slice
+	{
+		StreamedTexture* texture;
+		int level, row, rows;
+		size_t offset;
+		bool completes;
+	};
+
+	std::deque<StreamedTexture> textures;
+	std::vector<StreamedTexture> incoming;
+	std::mutex incomingMutex;
+
+	std::vector<Slice> slices;
+	GLuint buffer = 0;
+
+	TextureStream()
+	{
+		//	Checked once, on the main thread, since the loaders read it there.
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+		for (GLint i = 0; i < count; i++)
+		{
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (extension != NULL && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0) s3tc = true;
+		}
+	}
+
+	static GLenum formatOf(int _channels)
+	{
+		switch (_channels)
+		{
+			case 1:		return GL_RED;
+			case 2:		return GL_RG;
+			case 3:		return GL_RGB;
+			default:	return GL_RGBA;
+		}
+	}
+
+	/// <summary>
+	/// Allocates storage for every level, and limits sampling to the smallest one until the others are filled in.
+	/// Done before the unpack buffer is bound, as a bound buffer would turn the NULL into an offset.
+	/// </summary>
+	void allocate(StreamedTexture& _texture)
+	{
+		RenderState::get().editTexture(_texture.id);
+
+		//	Compressed formats are allocated through glTexImage2D as well, only the upload needs the compressed call.
+		GLenum format			= formatOf(_texture.channels);
+		GLenum internalFormat	= _texture.blockSize > 0 ? _texture.compressedFormat : format;
+
+		for (int i = 0; i < (int)_texture.levels.size(); i++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, i, internalFormat, _texture.widths[i], _texture.heights[i], 0, format, GL_UNSIGNED_BYTE, NULL);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,	_texture.level);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,	(GLint)_texture.levels.size() - 1);
+
+		_texture.allocated = true;
+	}
+};
@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <algorithm>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,6 +14,10 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "stb_image.h"
+#include "renderstate.h"
+#include "jobs.h"
+#include "texturestream.h"
+#include "dds.h"
 
 namespace util 
 {
@@ -52,7 +58,41 @@ namespace util
 	}
 
 	/// <summary>
-	/// Function to load a texture from the computers directory.
+	/// Uploads decoded pixels to a texture and generates its mipmaps.
+	/// </summary>
+	inline void uploadTexture(GLuint textureID, const unsigned char* data, int width, int height, int numChannels)
+	{
+		RenderState::get().editTexture(textureID);
+
+		if (numChannels == 3)		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+		else if (numChannels == 4)	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	/// <summary>
+	/// Uploads a cooked image, mip chain included.
+	/// </summary>
+	inline void uploadCompressed(GLuint textureID, const dds::Image& image)
+	{
+		RenderState::get().editTexture(textureID);
+
+		GLenum format = TextureStream::compressedFormatOf(image.format);
+		int width = image.width, height = image.height;
+
+		for (int i = 0; i < (int)image.levels.size(); i++)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, (GLsizei)image.levels[i].size(), image.levels[i].data());
+
+			width	= std::max(width / 2, 1);
+			height	= std::max(height / 2, 1);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+	}
+
+	/// <summary>
+	/// Function to load a texture from the computers directory. Prefers the cooked version of the file, if there is an up to date one.
 	/// </summary>
 	/// <param name="path">The path to pull the texture from.</param>
 	/// <param name="comp">Override for how many componenst the texture has. (Channels)</param>
@@ -62,12 +102,21 @@ namespace util
 		//	Generate and bind a texture. (Whatever that means ;_:)
 		GLuint textureID;
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		RenderState::get().editTexture(textureID);
 
 		//	Setting texture parameters.
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+		//	Using the cooked texture, which already has its mips.
+		dds::Image image;
+		if (dds::readCooked(path, image) && TextureStream::get().supports(image))
+		{
+			uploadCompressed(textureID, image);
+			RenderState::get().bindTexture(0, 0);
+			return textureID;
+		}
+
 		//	Loading the texture.
 		int width, height, numChannels;
 		unsigned char* data = stbi_load(path, &width, &height, &numChannels, comp);
@@ -76,11 +125,7 @@ namespace util
 		if (data)
 		{
 			if (comp != 0) numChannels = comp;
-
-			if (numChannels == 3)	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			else if (numChannels == 4)	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-			glGenerateMipmap(GL_TEXTURE_2D);
+			uploadTexture(textureID, data, width, height, numChannels);
 		}
 		else
 		{
@@ -89,12 +134,65 @@ namespace util
 
 		//	Unloading texture.
 		stbi_image_free(data);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		RenderState::get().bindTexture(0, 0);
 
 		//	Return it.
 		return textureID;
 	}
 
+	/// <summary>
+	/// Function to load a texture without waiting for it. The file is read on a worker thread, and then streamed in by the TextureStream
+	/// over the next frames. Until then the texture is a single grey texel. Prefers the cooked version of the file, if there is an up to date one,
+	/// otherwise the file is decoded and mipmapped on the worker.
+	/// </summary>
+	/// <param name="path">The path to pull the texture from.</param>
+	/// <param name="comp">Override for how many componenst the texture has. (Channels)</param>
+	/// <returns>The texture, usable right away.</returns>
+	inline GLuint loadTextureAsync(const char* path, int comp = 0)
+	{
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		RenderState::get().editTexture(textureID);
+
+		//	Setting texture parameters.
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		//	Placeholder, a single level is a complete texture even with a mipmapped filter.
+		unsigned char placeholder[4] = { 128, 128, 128, 255 };
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+		std::string file(path);
+		TextureStream* stream = &TextureStream::get();
+
+		jobs::async([textureID, file, comp, stream]()
+		{
+			dds::Image image;
+			if (dds::readCooked(file, image) && stream->supports(image))
+			{
+				stream->add(TextureStream::prepare(textureID, std::move(image)));
+				return;
+			}
+
+			//	Decoding here, stb_image is safe to use from several threads.
+			int width, height, numChannels;
+			unsigned char* data = stbi_load(file.c_str(), &width, &height, &numChannels, comp);
+
+			if (!data)
+			{
+				std::cout << "Error loading texture: " << file << "." << std::endl;
+				return;
+			}
+
+			if (comp != 0) numChannels = comp;
+
+			stream->add(TextureStream::prepare(textureID, data, width, height, numChannels));
+			stbi_image_free(data);
+		});
+
+		return textureID;
+	}
+
 	/// <summary>
 	/// Create a new program! (Comparable to Unity shader instance i.e material.)
 	/// </summary>
@@ -159,14 +257,17 @@ namespace util
 		delete fragmentSrc;
 	}
 
-	inline void createFrameBuffer(int width, int height, unsigned int& frameBufferID, unsigned int& colorBufferID, unsigned int& depthBufferID)
+	/// <summary>
+	/// Creates a frame buffer with a color texture, and a depth renderbuffer that also holds a stencil buffer if asked for.
+	/// </summary>
+	inline void createFrameBuffer(int width, int height, unsigned int& frameBufferID, unsigned int& colorBufferID, unsigned int& depthBufferID, bool stencil = false)
 	{
 		//	Generate frame buffer.
 		glGenFramebuffers(1, &frameBufferID);
 
 		//	Generate color buffer.
 		glGenTextures(1, &colorBufferID);
-		glBindTexture(GL_TEXTURE_2D, colorBufferID);
+		RenderState::get().editTexture(colorBufferID);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
@@ -174,12 +275,12 @@ namespace util
 		//	Generate depth buffer.
 		glGenRenderbuffers(1, &depthBufferID);
 		glBindRenderbuffer(GL_RENDERBUFFER, depthBufferID);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+		glRenderbufferStorage(GL_RENDERBUFFER, stencil ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT, width, height);
 
 		//	Attach buffers.
 		glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBufferID, 0);
-		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBufferID);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBufferID);
 
 		//	Check if succesful.
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+//	Vertex attributes, as bits of the shader location they are bound to.
+#define VERTEX_POSITION			(1 << 0)
+#define VERTEX_NORMAL			(1 << 1)
+#define VERTEX_TEXCOORDS		(1 << 2)
+#define VERTEX_TANGENT			(1 << 3)
+#define VERTEX_BITANGENT		(1 << 4)
+#define VERTEX_BONES			((1 << 5) | (1 << 6))
+#define VERTEX_ALL_ATTRIBUTES	0x7F
+
+//	Packing options, on top of the ones that are always used. (10:10:10:2 SNORM directions, and 16 bit UNORM texture coordinates
+//	when every one of a mesh's is inside [0, 1], full floats otherwise)
+#define VERTEX_PACK_NONE			0
+#define VERTEX_PACK_HALF_POSITION	(1 << 0)	//	Half float positions, 8 bytes instead of 12. Only precise enough for small models.
+
+struct VertexAttribute
+{
+	GLuint location;
+	GLint components;
+	GLenum type;
+	GLboolean normalized;
+	bool integer;
+	unsigned int offset;
+};
+
+/// <summary>
+/// Describes how vertices are laid out in a GL buffer, so a vertex array can be set up for any format.
+/// </summary>
+struct VertexLayout
+{
+	unsigned int stride = 0;
+	std::vector<VertexAttribute> attributes;
+
+	/// <summary>
+	/// Appends an attribute to the end of the vertex.
+	/// </summary>
+	/// <param name="_size">Bytes the attribute takes up.</param>
+	void add(GLuint _location, GLint _components, GLenum _type, GLboolean _normalized, unsigned int _size, bool _integer = false)
+	{
+		attributes.push_back({ _location, _components, _type, _normalized, _integer, stride });
+		stride += _size;
+	}
+
+	bool operator==(const VertexLayout& _other) const
+	{
+		if (stride != _other.stride || attributes.size() != _other.attributes.size()) return false;
+
+		for (size_t i = 0; i < attributes.size(); i++)
+		{
+			const VertexAttribute& a = attributes[i];
+			const VertexAttribute& b = _other.attributes[i];
+			if (a.location != b.location || a.components != b.components || a.type != b.type || a.normalized != b.normalized || a.integer != b.integer || a.offset != b.offset) return false;
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Points the bound vertex array at the bound vertex buffer.
+	/// </summary>
+	void apply() const
+	{
+		for (const VertexAttribute& attribute : attributes)
+		{
+			glEnableVertexAttribArray(attribute.location);
+
+			if (attribute.integer)	glVertexAttribIPointer(attribute.location, attribute.components, attribute.type, stride, (void*)(size_t)attribute.offset);
+			else					glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, stride, (void*)(size_t)attribute.offset);
+		}
+	}
+};
+
+namespace vertexformat
+{
+	/// <summary>
+	/// Converts a float to a half float, rounding to nearest. Out of range values become infinity, tiny ones zero.
+	/// </summary>
+	inline uint16_t toHalf(float _value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &_value, sizeof(bits));
+
+		uint32_t sign		= (bits >> 16) & 0x8000;
+		int exponent		= (int)((bits >> 23) & 0xFF) - 127 + 15;
+		uint32_t mantissa	= bits & 0x7FFFFF;
+
+		if (exponent >= 31)	return (uint16_t)(sign | 0x7C00);
+		if (exponent <= 0)
+		{
+			//	Denormals.
+			if (exponent < -10) return (uint16_t)sign;
+
+			mantissa = (mantissa | 0x800000) >> (1 - exponent);
+			return (uint16_t)(sign | ((mantissa + 0x1000) >> 13));
+		}
+
+		//	Rounding can carry into the exponent, which is still correct.
+		return (uint16_t)(sign | (((uint32_t)exponent << 10) + ((mantissa + 0x1000) >> 13)));
+	}
+
+	/// <summary>
+	/// Packs a direction into GL_INT_2_10_10_10_REV, as signed normalized values.
+	/// </summary>
+	inline uint32_t toSnorm10(const glm::vec3& _direction)
+	{
+		auto component = [](float _value) { return (uint32_t)((int)std::round(std::min(std::max(_value, -1.0f), 1.0f) * 511.0f) & 0x3FF); };
+
+		return component(_direction.x) | (component(_direction.y) << 10) | (component(_direction.z) << 20);
+	}
+};